@@ -0,0 +1,490 @@
+///////////////////////////////////////////////////////////////////////////
+// bench.c : Speed tests for the enhanced CORDIC routines
+//
+// Author: Mike Field <hamster@snap.net.nz>
+//
+// Times cordic_sine_cosine() (and the batch version) in ns per call
+// for a few configurations and patterns of input phase, alongside the
+// C library's sin(), cos() and sincos() on the same phases. Each test
+// is run a few times to warm up, then timed over a number of
+// repetitions to give the mean and a 95% confidence interval. The
+// results are written as JSON, so they can be kept and compared.
+//
+// Released under the MIT license - see enhanced_cordic.c
+///////////////////////////////////////////////////////////////////////////
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "cordic.h"
+#include "counters.h"
+#include "util.h"
+
+/* The configurations to test - the default, and a narrow one that fits the 32-bit batch kernel */
+static const struct {
+  int     index_bits, cordic_bits, cordic_reps;
+  int64_t output_scale;
+  int     output_extra_bits, z_extra_bits;
+} configs[] = {
+  {11, 19, 24, (int64_t)1<<31, 4, 2},
+  { 9, 14, 18, (int64_t)1<<26, 4, 2},
+  { 7, 13, 16, (int64_t)1<<22, 4, 2},
+};
+#define CONFIGS ((int)(sizeof(configs)/sizeof(configs[0])))
+
+enum pattern { SEQUENTIAL, RANDOM, STRIDED, DEPENDENT, PATTERNS };
+static const char *pattern_names[PATTERNS] = {"sequential", "random", "strided", "dependent"};
+
+/* CORDIC_BRANCH_FREE is cordic_sine_cosine() with the CORDIC_KERNEL_BRANCH_FREE kernel,
+ * CORDIC_GENERIC is with the rotation that loads angles[] and shifts[] rather than the unrolled one,
+ * and CORDIC_HYBRID is with the hybrid engine resolving hybrid_bits with a multiply-add */
+enum function { CORDIC, CORDIC_BRANCH_FREE, CORDIC_GENERIC, CORDIC_HYBRID, CORDIC_BATCH, LIBM_SIN_COS, LIBM_SINCOS,
+                FUNCTIONS };
+static const char *function_names[FUNCTIONS] = {"cordic_sine_cosine", "cordic_sine_cosine (branch-free)",
+                                                "cordic_sine_cosine (generic)", "cordic_sine_cosine (hybrid)",
+                                                "cordic_sine_cosine_batch", "sin+cos", "sincos"};
+
+int64_t calls       = (int64_t)1<<20;   /* Calls timed in each repetition */
+int     repetitions = 10;
+int     warmup      = 2;
+int     hybrid_bits = 4;                /* For CORDIC_HYBRID, set with -y */
+
+/* With -T, time each table storage for INDEX_BITS from TABLE_BITS_MIN to TABLE_BITS_MAX instead */
+int     table_sizes = 0;
+#define TABLE_BITS_MIN  (11)
+#define TABLE_BITS_MAX  (20)
+
+/* With -U, time and check the multiply tail at each cut-over iteration instead */
+int     tail_sweep  = 0;
+
+/* Hardware counters, with -p */
+int     use_perf    = 0;
+struct perf_counters counters;
+
+/* Keeps the results alive, so the calls can't be optimized away */
+volatile int64_t sink_i;
+volatile double  sink_d;
+
+/***************************************************************
+ * Fill in the phases for a pattern. Sequential phases walk through
+ * one table block after another, strided phases step just over a
+ * table block each time so every call uses a different table entry,
+ * and random phases are spread over the whole circle. The dependent
+ * pattern uses the random phases, but each call's phase also depends
+ * on the last call's result, so it measures latency rather than
+ * throughput. A chain like that can't be batched, so the batch
+ * routine isn't timed on it.
+ **************************************************************/
+static void make_phases(const struct cordic_config *cfg, enum pattern p, int64_t *phase) {
+  uint64_t state = 1;
+  int64_t i, stride = ((int64_t)1<<cfg->cordic_bits) + 1;
+
+  for(i = 0; i < calls; i++) {
+    switch(p) {
+      case SEQUENTIAL: phase[i] = i & (cfg->full_circle-1);                         break;
+      case STRIDED:    phase[i] = (i*stride) & (cfg->full_circle-1);                break;
+      default:         phase[i] = next_random(&state) & (cfg->full_circle-1);       break;
+    }
+  }
+}
+
+/* Time one repetition, returning ns per call */
+static double run_once(const struct cordic_config *cfg, enum function fn, enum pattern p,
+                       const int64_t *phase, int64_t *s, int64_t *c) {
+  const double to_radians = 2*PI/cfg->full_circle;
+  const int64_t mask = cfg->full_circle-1;
+  int64_t i, acc = 0;
+  double t0, t1, dacc = 0.0;
+
+  t0 = seconds();
+  if(p == DEPENDENT) {
+    int64_t last = 0;
+    double dlast = 0.0;
+
+    for(i = 0; i < calls; i++) {
+      switch(fn) {
+        case CORDIC:
+        case CORDIC_BRANCH_FREE:
+        case CORDIC_GENERIC:
+        case CORDIC_HYBRID: {
+          int64_t z = (phase[i] + (last & 1)) & mask;
+          cordic_sine_cosine(cfg, z, s, c);
+          last = *s;
+          break;
+        }
+        case LIBM_SIN_COS: {
+          double a = ((phase[i] + (dlast > 0.0)) & mask) * to_radians;
+          dlast = sin(a) + cos(a);
+          break;
+        }
+        default: {
+          double a = ((phase[i] + (dlast > 0.0)) & mask) * to_radians, ds, dc;
+          sincos(a, &ds, &dc);
+          dlast = ds + dc;
+          break;
+        }
+      }
+    }
+    acc  = last;
+    dacc = dlast;
+  } else {
+    switch(fn) {
+      case CORDIC:
+      case CORDIC_BRANCH_FREE:
+      case CORDIC_GENERIC:
+      case CORDIC_HYBRID:
+        for(i = 0; i < calls; i++)
+          cordic_sine_cosine(cfg, phase[i], s+i, c+i);
+        break;
+      case CORDIC_BATCH:
+        cordic_sine_cosine_batch(cfg, phase, s, c, calls);
+        break;
+      case LIBM_SIN_COS:
+        for(i = 0; i < calls; i++) {
+          double a = phase[i] * to_radians;
+          dacc += sin(a) + cos(a);
+        }
+        break;
+      default:
+        for(i = 0; i < calls; i++) {
+          double ds, dc;
+          sincos(phase[i] * to_radians, &ds, &dc);
+          dacc += ds + dc;
+        }
+        break;
+    }
+    if(fn != LIBM_SIN_COS && fn != LIBM_SINCOS)
+      acc = s[calls-1] + c[calls/2];
+  }
+  t1 = seconds();
+
+  sink_i = acc;
+  sink_d = dacc;
+  return (t1 - t0) * 1e9 / calls;
+}
+
+/* Two sided 95% points of Student's t distribution, for 1 to 30 degrees of freedom */
+static double t_95(int df) {
+  static const double t[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  return df < 1 ? 0.0 : df <= 30 ? t[df-1] : 1.96;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static void bench(FILE *out, const struct cordic_config *cfg, enum function fn, enum pattern p,
+                  const int64_t *phase, int64_t *s, int64_t *c, int first) {
+  double *ns = malloc(repetitions * sizeof(double));
+  double mean = 0.0, var = 0.0, ci;
+  struct perf_reading before, after;
+  struct perf_totals counts;
+  int i;
+
+  if(ns == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  for(i = 0; i < warmup; i++)
+    run_once(cfg, fn, p, phase, s, c);
+  memset(&counts, 0, sizeof(counts));
+  for(i = 0; i < repetitions; i++) {
+    if(use_perf)
+      perf_read(&counters, &before);
+    ns[i] = run_once(cfg, fn, p, phase, s, c);
+    if(use_perf) {
+      perf_read(&counters, &after);
+      perf_add(&counts, &before, &after);
+    }
+    mean += ns[i] / repetitions;
+  }
+  for(i = 0; i < repetitions; i++)
+    var += (ns[i]-mean)*(ns[i]-mean) / (repetitions > 1 ? repetitions-1 : 1);
+  ci = t_95(repetitions-1) * sqrt(var / repetitions);
+  qsort(ns, repetitions, sizeof(double), compare_double);
+
+  fprintf(stderr, "%-34s %-10s %9.3f ns +/- %7.3f  (%6.2f M calls/s)\n",
+          function_names[fn], pattern_names[p], mean, ci, 1e3/mean);
+  fprintf(out, "%s\n      {\"function\": \"%s\", \"pattern\": \"%s\", \"ns_per_call\": {\"mean\": %.4f, \"ci95\": %.4f, "
+          "\"median\": %.4f, \"min\": %.4f, \"max\": %.4f, \"stddev\": %.4f}, \"calls_per_second\": %.0f",
+          first ? "" : ",", function_names[fn], pattern_names[p], mean, ci,
+          ns[repetitions/2], ns[0], ns[repetitions-1], sqrt(var), 1e9/mean);
+  if(use_perf) {
+    /* Per call, including the loop and timing around it */
+    fprintf(out, ", \"counters_per_call\": ");
+    perf_json(out, &counts, (double)calls*repetitions);
+  }
+  fprintf(out, "}");
+  free(ns);
+}
+
+/***************************************************************
+ * Time cordic_sine_cosine() with each table storage as the table
+ * grows, keeping 2+INDEX_BITS+CORDIC_BITS at 32 bits
+ **************************************************************/
+static int bench_table_sizes(FILE *out, int64_t *phase, int64_t *s, int64_t *c) {
+  int index_bits, storage, first = 1;
+
+  fprintf(out, "  \"table_sizes\": [");
+  for(index_bits = TABLE_BITS_MIN; index_bits <= TABLE_BITS_MAX; index_bits++) {
+    for(storage = 0; storage < CORDIC_STORAGES; storage++) {
+      struct cordic_config cfg;
+      int p;
+
+      memset(&cfg, 0, sizeof(cfg));
+      cfg.index_bits        = index_bits;
+      cfg.cordic_bits       = 30-index_bits;
+      cfg.cordic_reps       = cfg.cordic_bits+5;
+      cfg.output_scale      = (int64_t)1<<31;
+      cfg.output_extra_bits = 4;
+      cfg.z_extra_bits      = 2;
+      cfg.storage           = storage;
+      if(setup(&cfg) != 0)
+        return -1;
+
+      fprintf(stderr, "INDEX_BITS %i, %s table of %li bytes\n", index_bits, cordic_storage_names[storage], cfg.table_bytes);
+      fprintf(out, "%s\n    {\"index_bits\": %i, \"cordic_bits\": %i, \"cordic_reps\": %i, \"storage\": \"%s\", "
+              "\"table_bytes\": %li, \"table_ms\": %.4f,\n     \"results\": [",
+              first ? "" : ",", cfg.index_bits, cfg.cordic_bits, cfg.cordic_reps, cordic_storage_names[storage],
+              cfg.table_bytes, cfg.table_seconds*1e3);
+      for(p = 0; p < PATTERNS; p++) {
+        make_phases(&cfg, p, phase);
+        bench(out, &cfg, CORDIC, p, phase, s, c, p == 0);
+      }
+      fprintf(out, "]}");
+      cordic_free(&cfg);
+      first = 0;
+    }
+  }
+  fprintf(out, "\n  ]\n}\n");
+  return 0;
+}
+
+/***************************************************************
+ * The error of cordic_sine_cosine() measured as enhanced_cordic.c
+ * does: against (int64_t)(v-0.5) of the scaled sin() and cos(),
+ * worked out in long double, with the mean being of the SIN and
+ * COS errors added together - so the figures match the verifier's
+ * "Error is ... per calculation" and "Max error" for the same phases
+ **************************************************************/
+static int64_t expected(long double v) {
+  return (int64_t)(v - 0.5L);
+}
+
+static void tail_errors(const struct cordic_config *cfg, const int64_t *phase, double *max, double *mean) {
+  const long double to_radians = 2*3.14159265358979323846264338327950288L/cfg->full_circle;
+  int64_t i;
+
+  *max = *mean = 0.0;
+  for(i = 0; i < calls; i++) {
+    int64_t s, c;
+    double es, ec;
+
+    cordic_sine_cosine(cfg, phase[i], &s, &c);
+    es = fabs((double)(s - expected(sinl(phase[i] * to_radians) * cfg->output_scale)));
+    ec = fabs((double)(c - expected(cosl(phase[i] * to_radians) * cfg->output_scale)));
+    if(*max < es) *max = es;
+    if(*max < ec) *max = ec;
+    *mean += (es + ec) / calls;
+  }
+}
+
+/***************************************************************
+ * For each configuration, time cordic_sine_cosine() and measure
+ * its error with the multiply tail taking over after each number
+ * of iterations, and without it (tail_from 0). All use the table
+ * driven rotation, so only the cut-over differs. 'stages' is what
+ * a pipeline would need - an iteration each, plus one for the
+ * multiply.
+ **************************************************************/
+static int bench_tails(FILE *out, int64_t *phase, int64_t *s, int64_t *c) {
+  int i, tail_from, first = 1;
+
+  fprintf(out, "  \"tails\": [");
+  for(i = 0; i < CONFIGS; i++) {
+    for(tail_from = 0; tail_from <= configs[i].cordic_reps; tail_from++) {
+      struct cordic_config cfg;
+      double max, mean;
+      int p, stages = tail_from > 0 ? tail_from+1 : configs[i].cordic_reps;
+
+      memset(&cfg, 0, sizeof(cfg));
+      cfg.index_bits        = configs[i].index_bits;
+      cfg.cordic_bits       = configs[i].cordic_bits;
+      cfg.cordic_reps       = configs[i].cordic_reps;
+      cfg.output_scale      = configs[i].output_scale;
+      cfg.output_extra_bits = configs[i].output_extra_bits;
+      cfg.z_extra_bits      = configs[i].z_extra_bits;
+      cfg.generic           = 1;
+      cfg.tail_from         = tail_from;
+      if(setup(&cfg) != 0)
+        return -1;
+
+      make_phases(&cfg, RANDOM, phase);
+      tail_errors(&cfg, phase, &max, &mean);
+      fprintf(stderr, "INDEX_BITS %i, CORDIC_BITS %i, CORDIC_REPS %i, tail from %i: %i stages, "
+              "max error %.3f, mean error %.4f\n", cfg.index_bits, cfg.cordic_bits, cfg.cordic_reps, tail_from,
+              stages, max, mean);
+      fprintf(out, "%s\n    {\"index_bits\": %i, \"cordic_bits\": %i, \"cordic_reps\": %i, \"tail_from\": %i, "
+              "\"stages\": %i, \"max_error\": %.4f, \"mean_error\": %.6f,\n     \"results\": [",
+              first ? "" : ",", cfg.index_bits, cfg.cordic_bits, cfg.cordic_reps, tail_from, stages, max, mean);
+      for(p = 0; p < PATTERNS; p++) {
+        make_phases(&cfg, p, phase);
+        bench(out, &cfg, CORDIC, p, phase, s, c, p == 0);
+      }
+      fprintf(out, "]}");
+      cordic_free(&cfg);
+      first = 0;
+    }
+  }
+  fprintf(out, "\n  ]\n}\n");
+  return 0;
+}
+
+/**************************************************************/
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-n calls] [-r repetitions] [-w warmup] [-y hybrid_bits] [-p] [-T] [-U]\n"
+                  "          [-o json_file]\n", name);
+  exit(1);
+}
+
+/**************************************************************/
+int main(int argc, char *argv[]) {
+  const char *output = NULL;
+  int64_t *phase, *s, *c;
+  FILE *out = stdout;
+  int i, opt;
+
+  while((opt = getopt(argc, argv, "n:r:w:y:pTUo:")) != -1) {
+    switch(opt) {
+      case 'n': calls       = atol(optarg);  break;
+      case 'r': repetitions = atoi(optarg);  break;
+      case 'w': warmup      = atoi(optarg);  break;
+      case 'y': hybrid_bits = atoi(optarg);  break;
+      case 'o': output      = optarg;        break;
+      case 'p': use_perf    = 1;             break;
+      case 'T': table_sizes = 1;             break;
+      case 'U': tail_sweep  = 1;             break;
+      default:  usage(argv[0]);
+    }
+  }
+  if(calls < 1 || repetitions < 1 || warmup < 0 || hybrid_bits < 1)
+    usage(argv[0]);
+
+  phase = malloc(calls * sizeof(int64_t));
+  s     = malloc(calls * sizeof(int64_t));
+  c     = malloc(calls * sizeof(int64_t));
+  if(phase == NULL || s == NULL || c == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  if(use_perf && perf_open(&counters) == 0) {
+    fprintf(stderr, "Hardware counters are not available (%s), carrying on without them\n", perf_error());
+    use_perf = 0;
+  }
+  if(output) {
+    out = fopen(output, "w");
+    if(out == NULL) {
+      fprintf(stderr, "Unable to write '%s'\n", output);
+      return 1;
+    }
+  }
+
+  fprintf(out, "{\n  \"calls\": %li, \"repetitions\": %i, \"warmup\": %i,\n", calls, repetitions, warmup);
+  if(table_sizes) {
+    if(bench_table_sizes(out, phase, s, c) != 0)
+      return 1;
+  } else if(tail_sweep) {
+    if(bench_tails(out, phase, s, c) != 0)
+      return 1;
+  } else {
+    fprintf(out, "  \"configs\": [");
+    for(i = 0; i < CONFIGS; i++) {
+      struct cordic_config cfg, branch_free, generic, hybrid;
+      struct perf_reading before, after;
+      struct perf_totals setup_counts;
+      int p, fn;
+
+      memset(&cfg, 0, sizeof(cfg));
+      cfg.index_bits        = configs[i].index_bits;
+      cfg.cordic_bits       = configs[i].cordic_bits;
+      cfg.cordic_reps       = configs[i].cordic_reps;
+      cfg.output_scale      = configs[i].output_scale;
+      cfg.output_extra_bits = configs[i].output_extra_bits;
+      cfg.z_extra_bits      = configs[i].z_extra_bits;
+      if(use_perf)
+        perf_read(&counters, &before);
+      if(setup(&cfg) != 0)
+        return 1;
+      memset(&setup_counts, 0, sizeof(setup_counts));
+      if(use_perf) {
+        perf_read(&counters, &after);
+        perf_add(&setup_counts, &before, &after);
+      }
+      memset(&branch_free, 0, sizeof(branch_free));
+      branch_free.index_bits        = cfg.index_bits;
+      branch_free.cordic_bits       = cfg.cordic_bits;
+      branch_free.cordic_reps       = cfg.cordic_reps;
+      branch_free.output_scale      = cfg.output_scale;
+      branch_free.output_extra_bits = cfg.output_extra_bits;
+      branch_free.z_extra_bits      = cfg.z_extra_bits;
+      branch_free.kernel            = CORDIC_KERNEL_BRANCH_FREE;
+      if(setup(&branch_free) != 0)
+        return 1;
+      generic         = branch_free;
+      generic.kernel  = CORDIC_KERNEL_DEFAULT;
+      generic.generic = 1;
+      if(setup(&generic) != 0)
+        return 1;
+      hybrid             = generic;
+      hybrid.generic     = 0;
+      hybrid.hybrid_bits = hybrid_bits;
+      if(setup(&hybrid) != 0)
+        return 1;
+
+      fprintf(stderr, "INDEX_BITS %i, CORDIC_BITS %i, CORDIC_REPS %i, OUTPUT_SCALE %li%s\n", cfg.index_bits,
+              cfg.cordic_bits, cfg.cordic_reps, cfg.output_scale, cfg.narrow ? " (narrow)" : "");
+      fprintf(out, "%s\n    {\"index_bits\": %i, \"cordic_bits\": %i, \"cordic_reps\": %i, \"output_scale\": %li, "
+              "\"output_extra_bits\": %i, \"z_extra_bits\": %i, \"narrow\": %s, \"table_ms\": %.4f,",
+              i ? "," : "", cfg.index_bits, cfg.cordic_bits, cfg.cordic_reps, cfg.output_scale,
+              cfg.output_extra_bits, cfg.z_extra_bits, cfg.narrow ? "true" : "false", cfg.table_seconds*1e3);
+      if(use_perf) {
+        fprintf(out, "\n     \"setup_counters\": ");
+        perf_json(out, &setup_counts, 1.0);
+        fprintf(out, ",");
+      }
+      fprintf(out, "\n     \"results\": [");
+      for(p = 0; p < PATTERNS; p++) {
+        make_phases(&cfg, p, phase);
+        for(fn = 0; fn < FUNCTIONS; fn++)
+          if(fn != CORDIC_BATCH || p != DEPENDENT)
+            bench(out, fn == CORDIC_BRANCH_FREE ? &branch_free : fn == CORDIC_GENERIC ? &generic :
+                       fn == CORDIC_HYBRID ? &hybrid : &cfg, fn, p, phase, s, c, p == 0 && fn == 0);
+      }
+      fprintf(out, "]}");
+      cordic_free(&cfg);
+      cordic_free(&branch_free);
+      cordic_free(&generic);
+      cordic_free(&hybrid);
+    }
+    fprintf(out, "\n  ]\n}\n");
+  }
+
+  if(output && fclose(out) != 0) {
+    fprintf(stderr, "Unable to write '%s'\n", output);
+    return 1;
+  }
+  if(use_perf)
+    perf_close(&counters);
+  free(phase);
+  free(s);
+  free(c);
+  return 0;
+}
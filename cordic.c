@@ -0,0 +1,1185 @@
+///////////////////////////////////////////////////////////////////////////
+// cordic.c : The enhanced CORDIC SIN()/COS() routines
+//
+// Author: Mike Field <hamster@snap.net.nz>
+//
+// See enhanced_cordic.c for a description of the algorithm, and
+// cordic.h for how to use these routines.
+//
+// Released under the MIT license - see enhanced_cordic.c
+///////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cordic.h"
+#include "util.h"
+#ifdef CORDIC_TABLES
+#include "cordic_tables.h"
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#define HUGE_PAGE_SIZE    ((size_t)2<<20)
+
+/***************************************************************
+ * The CORDIC angle constants. setup() fills angles[] from these,
+ * and the unrolled rotations below call them with constant
+ * arguments, so the compiler works them out when building.
+ **************************************************************/
+static inline double cordic_start_bits(int index_bits) {
+   double table_angle      = PI / 2.0 / ((int64_t)1<<index_bits);
+   double half_table_angle = table_angle / 2.0;
+
+   return log(atan(half_table_angle))/log(2.0);
+}
+
+/* The angle, in radians, that CORDIC iteration 'i' rotates by */
+static inline double cordic_angle_radians(int index_bits, int i) {
+   return atan(1.0/pow(2,i-ceil(cordic_start_bits(index_bits))));
+}
+
+/* The same angle in the units of 'z', which must be below INT32_MAX */
+static inline double cordic_angle(int index_bits, int cordic_bits, int z_extra_bits, int i) {
+   int64_t full_circle = (int64_t)1<<(2+index_bits+cordic_bits);
+
+   return full_circle * cordic_angle_radians(index_bits, i) / (2*PI) * ((int64_t)1<<(z_extra_bits+i))+1;
+}
+
+/* One CORDIC iteration */
+static inline __attribute__((always_inline))
+void cordic_step(int branch_free, int shift, int32_t angle, int64_t *xp, int64_t *yp, int64_t *zp) {
+   int64_t x = *xp, y = *yp, z = *zp;
+   int64_t tx = x >> shift;
+   int64_t ty = y >> shift;
+
+   if(branch_free) {
+     int64_t m = z >> 63;     /* All ones if z < 0 */
+
+     x -= (ty ^ m) - m;
+     y += (tx ^ m) - m;
+     z -= (angle ^ m) - m;
+   } else {
+     x -= (z < 0) ?   -ty :    ty;
+     y += (z < 0) ?   -tx :    tx;
+     z += (z < 0) ? angle : -angle;
+   }
+   *xp = x;
+   *yp = y;
+   *zp = z << 1;
+}
+
+/* A seed, from initial[] or packed[] as 'storage' says */
+static inline __attribute__((always_inline))
+int64_t cordic_seed(const struct cordic_config *cfg, int storage, int64_t i) {
+   return storage == CORDIC_STORAGE_PACKED ? cordic_unpack(cfg->packed, i) : cfg->initial[i];
+}
+
+/***************************************************************
+ * The hybrid engine's first step. The top hybrid_bits of z pick
+ * the middle of a sub-block, an odd multiple 'k' of half of one,
+ * and the seeds are rotated there with one multiply-add each,
+ * using deriv[] - each initial[] entry times half a sub-block's
+ * angle in radians, with hybrid_shift fraction bits. This is only
+ * first order, so is out by about delta^2/2, but CORDIC is left with
+ * less than half a sub-block to resolve, so can skip the first
+ * hybrid_bits iterations.
+ **************************************************************/
+static inline __attribute__((always_inline))
+int cordic_first_order(const struct cordic_config *cfg, int cordic_bits, int z_extra_bits, int64_t ix, int64_t iy,
+                       int64_t *xp, int64_t *yp, int64_t *zp) {
+   int     sub_shift = cordic_bits+z_extra_bits-cfg->hybrid_bits;
+   /* z runs from -half to +half a block inclusive, so +half goes in the top sub-block */
+   int64_t k         = 2*((*zp - (*zp > 0)) >> sub_shift) + 1;
+   int64_t round     = (int64_t)1<<(cfg->hybrid_shift-1);
+   int64_t x         = *xp;
+
+   *xp = x   - ((k*cfg->deriv[iy] + round) >> cfg->hybrid_shift);
+   *yp = *yp + ((k*cfg->deriv[ix] + round) >> cfg->hybrid_shift);
+   *zp = (*zp - k*((int64_t)1<<(sub_shift-1))) << cfg->hybrid_bits;
+   return cfg->hybrid_bits;
+}
+
+/***************************************************************
+ * The multiply tail. After cfg->tail_from iterations what is left
+ * in z is small enough that sin(z) = z and cos(z) = 1 near enough,
+ * so the rest of the rotation is x -= z*y and y += z*x. z is first
+ * turned into radians, with tail_shift fraction bits, by a multiply
+ * by tail_scale. In hardware that is one DSP multiply per output
+ * rather than a pipeline stage per iteration.
+ **************************************************************/
+static inline __attribute__((always_inline))
+void cordic_tail(const struct cordic_config *cfg, int64_t *xp, int64_t *yp, int64_t z) {
+   int64_t a     = (z * cfg->tail_scale + ((int64_t)1<<cfg->tail_scale_shift>>1)) >> cfg->tail_scale_shift;
+   int64_t round = (int64_t)1<<(cfg->tail_shift-1);
+   int64_t x     = *xp;
+
+   *xp = x   - ((a * *yp + round) >> cfg->tail_shift);
+   *yp = *yp + ((a * x   + round) >> cfg->tail_shift);
+}
+
+/***************************************************************
+ * The CORDIC rotation for the quadrant, table index and angle
+ * held in 'z'. The raw x (COS) and y (SIN) are returned before
+ * the quadrant's signs are applied and the extra bits removed.
+ *
+ * This is always inlined, so that the compiler builds a separate
+ * copy for each way it is called. When 'trace' is NULL there is no
+ * tracing at all in the loop, and when the parameters are
+ * constants they are folded into the code.
+ *
+ * With 'branch_free' set, the choices that depend on the phase are
+ * made with masks rather than branches or selects: 'm' is all ones
+ * when the choice is taken and zero when not, so (v^m)-m is v or -v
+ * and (v&m) is v or 0. The results are exactly the same.
+ *
+ * With 'unrolled' set, which needs constant parameters, the loop
+ * is unrolled completely and the shifts and angles are worked out
+ * by the compiler rather than loaded from shifts[] and angles[].
+ *
+ * 'storage' says whether the seeds come from initial[] or packed[],
+ * see cordic_seed().
+ *
+ * With 'hybrid' set (H in the kernel variants below) the first
+ * cfg->hybrid_bits iterations are replaced by cordic_first_order(),
+ * and with 'tail' set (T) the iterations from cfg->tail_from on are
+ * replaced by cordic_tail(), both above.
+ **************************************************************/
+static inline __attribute__((always_inline))
+void cordic_rotate_body(const struct cordic_config *cfg, int index_bits, int cordic_bits, int cordic_reps,
+                        int z_extra_bits, int branch_free, int unrolled, int storage, int hybrid, int tail,
+                        int64_t z, int64_t *xr, int64_t *yr, struct cordic_trace_record *trace) {
+   int8_t quadrant_bit0;
+   int64_t index, x, y;
+   int64_t last = ((int64_t)1<<index_bits)-1;
+   int i, first = 0, end = tail ? cfg->tail_from : cordic_reps;
+
+   /* Split into sections */
+   quadrant_bit0 = (z >> (cordic_bits+index_bits)) & 1;
+   index         = (z >> cordic_bits) & (((int64_t)1<<index_bits)-1);
+   z             = (z & (((int64_t)1<<cordic_bits)-1)) << z_extra_bits;
+
+   if(branch_free) {
+     int64_t m = -(int64_t)quadrant_bit0;
+
+     z  = ((z ^ m) - m) + (m & ((int64_t)1<<(cordic_bits+z_extra_bits)));
+   } else if(quadrant_bit0) {
+     z = ((int64_t)1<<(cordic_bits+z_extra_bits)) -z;
+   }
+
+   /* Subtract half the sector angle from Z */
+   z -= (int64_t)1<<(cordic_bits+z_extra_bits-1);
+
+   if(storage == CORDIC_STORAGE_PAIRED) {
+     /* Entries index and last-index are side by side, in the pair for
+      * whichever of them is in the first half of the table - 'a' */
+     int64_t top = index >> (index_bits-1);
+     const int64_t *pair = cfg->paired + 2*(index ^ (-top & last));
+     int64_t a = pair[0], b = pair[1];
+
+     if(branch_free) {
+       int64_t m = -(int64_t)(quadrant_bit0 ^ top);
+
+       x = b ^ ((a ^ b) & m);
+       y = a ^ ((a ^ b) & m);
+     } else if(quadrant_bit0 ^ top) {
+       x = a;
+       y = b;
+     } else {
+       x = b;
+       y = a;
+     }
+   } else if(branch_free) {
+     int64_t m = -(int64_t)quadrant_bit0;
+
+     /* index^last is the mirror entry, last-index */
+     x = cordic_seed(cfg, storage, index ^ (~m & last));
+     y = cordic_seed(cfg, storage, index ^ ( m & last));
+   } else if(quadrant_bit0) {
+     /* Use Dual Port memory for this */
+     x = cordic_seed(cfg, storage, index);
+     y = cordic_seed(cfg, storage, last-index);
+   } else {
+     x = cordic_seed(cfg, storage, last-index);
+     y = cordic_seed(cfg, storage, index);
+   }
+
+   if(trace) {
+     trace[0].x = x;
+     trace[0].y = y;
+     trace[0].z = z;
+   }
+
+   /* Only with wide storage - x is from initial[ix] and y from its mirror */
+   if(hybrid) {
+     int64_t ix = quadrant_bit0 ? index : last-index;
+
+     first = cordic_first_order(cfg, cordic_bits, z_extra_bits, ix, last-ix, &x, &y, &z);
+     for(i = 0; trace && i < first; i++) {
+       trace[i+1].x = x;
+       trace[i+1].y = y;
+       trace[i+1].z = z;
+     }
+   }
+
+   if(unrolled) {
+#pragma GCC unroll 64
+     for(i = 0; i < cordic_reps; i++ ) {
+       cordic_step(branch_free, index_bits+i, cordic_angle(index_bits, cordic_bits, z_extra_bits, i), &x, &y, &z);
+       if(trace) {
+         trace[i+1].x = x;
+         trace[i+1].y = y;
+         trace[i+1].z = z;
+       }
+     }
+   } else {
+     for(i = first; i < end; i++ ) {
+       cordic_step(branch_free, cfg->shifts[i], cfg->angles[i], &x, &y, &z);
+       if(trace) {
+         trace[i+1].x = x;
+         trace[i+1].y = y;
+         trace[i+1].z = z;
+       }
+     }
+   }
+
+   if(tail) {
+     cordic_tail(cfg, &x, &y, z);
+     for(i = end; trace && i < cordic_reps; i++) {
+       trace[i+1].x = x;
+       trace[i+1].y = y;
+       trace[i+1].z = 0;
+     }
+   }
+   *xr = x;
+   *yr = y;
+}
+
+/* The rotation for any configuration, for each kernel (K) and storage (S), with the hybrid engine (H)
+ * and with the multiply tail (T) */
+#define CORDIC_GENERIC(NAME, K, S, H, T) \
+static void NAME(const struct cordic_config *cfg, int64_t z, int64_t *x, int64_t *y) { \
+   cordic_rotate_body(cfg, cfg->index_bits, cfg->cordic_bits, cfg->cordic_reps, cfg->z_extra_bits, K, 0, S, H, T, \
+                      z, x, y, NULL); \
+}
+
+CORDIC_GENERIC(cordic_rotate_generic,                    0, CORDIC_STORAGE_WIDE,   0, 0)
+CORDIC_GENERIC(cordic_rotate_generic_branch_free,        1, CORDIC_STORAGE_WIDE,   0, 0)
+CORDIC_GENERIC(cordic_rotate_generic_packed,             0, CORDIC_STORAGE_PACKED, 0, 0)
+CORDIC_GENERIC(cordic_rotate_generic_branch_free_packed, 1, CORDIC_STORAGE_PACKED, 0, 0)
+CORDIC_GENERIC(cordic_rotate_generic_paired,             0, CORDIC_STORAGE_PAIRED, 0, 0)
+CORDIC_GENERIC(cordic_rotate_generic_branch_free_paired, 1, CORDIC_STORAGE_PAIRED, 0, 0)
+CORDIC_GENERIC(cordic_rotate_hybrid,                     0, CORDIC_STORAGE_WIDE,   1, 0)
+CORDIC_GENERIC(cordic_rotate_hybrid_branch_free,         1, CORDIC_STORAGE_WIDE,   1, 0)
+CORDIC_GENERIC(cordic_rotate_tail,                       0, CORDIC_STORAGE_WIDE,   0, 1)
+CORDIC_GENERIC(cordic_rotate_tail_branch_free,           1, CORDIC_STORAGE_WIDE,   0, 1)
+CORDIC_GENERIC(cordic_rotate_tail_packed,                0, CORDIC_STORAGE_PACKED, 0, 1)
+CORDIC_GENERIC(cordic_rotate_tail_branch_free_packed,    1, CORDIC_STORAGE_PACKED, 0, 1)
+CORDIC_GENERIC(cordic_rotate_tail_paired,                0, CORDIC_STORAGE_PAIRED, 0, 1)
+CORDIC_GENERIC(cordic_rotate_tail_branch_free_paired,    1, CORDIC_STORAGE_PAIRED, 0, 1)
+CORDIC_GENERIC(cordic_rotate_hybrid_tail,                0, CORDIC_STORAGE_WIDE,   1, 1)
+CORDIC_GENERIC(cordic_rotate_hybrid_tail_branch_free,    1, CORDIC_STORAGE_WIDE,   1, 1)
+
+/* Indexed by whether there is a multiply tail, then storage and kernel */
+static const cordic_rotate_fn generic[2][CORDIC_STORAGES][CORDIC_KERNELS] = {
+   {
+     {cordic_rotate_generic,        cordic_rotate_generic_branch_free},
+     {cordic_rotate_generic_packed, cordic_rotate_generic_branch_free_packed},
+     {cordic_rotate_generic_paired, cordic_rotate_generic_branch_free_paired},
+   }, {
+     {cordic_rotate_tail,           cordic_rotate_tail_branch_free},
+     {cordic_rotate_tail_packed,    cordic_rotate_tail_branch_free_packed},
+     {cordic_rotate_tail_paired,    cordic_rotate_tail_branch_free_paired},
+   }
+};
+
+static const cordic_rotate_fn hybrid[2][CORDIC_KERNELS] = {
+   {cordic_rotate_hybrid,      cordic_rotate_hybrid_branch_free},
+   {cordic_rotate_hybrid_tail, cordic_rotate_hybrid_tail_branch_free},
+};
+
+/***************************************************************
+ * Configurations that are used a lot get their own copy of the
+ * rotation, with INDEX_BITS, CORDIC_BITS, CORDIC_REPS and
+ * Z_EXTRA_BITS as constants and the loop unrolled. setup() picks
+ * one if it matches, after checking that the angles built into it
+ * are the same as those in angles[].
+ **************************************************************/
+#define CORDIC_SPECIALIZED_ROTATION(I, C, R, Z, SUFFIX, K, S) \
+static void cordic_rotate_##I##_##C##_##R##_##Z##SUFFIX(const struct cordic_config *cfg, int64_t z, \
+                                                        int64_t *x, int64_t *y) { \
+   cordic_rotate_body(cfg, I, C, R, Z, K, 1, S, 0, 0, z, x, y, NULL); \
+}
+
+#define CORDIC_SPECIALIZE(I, C, R, Z) \
+CORDIC_SPECIALIZED_ROTATION(I, C, R, Z, ,                    0, CORDIC_STORAGE_WIDE) \
+CORDIC_SPECIALIZED_ROTATION(I, C, R, Z, _branch_free,        1, CORDIC_STORAGE_WIDE) \
+CORDIC_SPECIALIZED_ROTATION(I, C, R, Z, _packed,             0, CORDIC_STORAGE_PACKED) \
+CORDIC_SPECIALIZED_ROTATION(I, C, R, Z, _branch_free_packed, 1, CORDIC_STORAGE_PACKED) \
+CORDIC_SPECIALIZED_ROTATION(I, C, R, Z, _paired,             0, CORDIC_STORAGE_PAIRED) \
+CORDIC_SPECIALIZED_ROTATION(I, C, R, Z, _branch_free_paired, 1, CORDIC_STORAGE_PAIRED) \
+static void cordic_angles_##I##_##C##_##R##_##Z(int32_t *angles) { \
+   int i; \
+   _Pragma("GCC unroll 64") \
+   for(i = 0; i < R; i++) \
+     angles[i] = cordic_angle(I, C, Z, i); \
+}
+
+CORDIC_SPECIALIZE(11, 19, 24, 2)
+CORDIC_SPECIALIZE( 9, 14, 18, 2)
+CORDIC_SPECIALIZE( 7, 13, 16, 2)
+
+#define CORDIC_SPECIALIZED(I, C, R, Z) \
+   {I, C, R, Z, {{cordic_rotate_##I##_##C##_##R##_##Z,        cordic_rotate_##I##_##C##_##R##_##Z##_branch_free}, \
+                 {cordic_rotate_##I##_##C##_##R##_##Z##_packed, cordic_rotate_##I##_##C##_##R##_##Z##_branch_free_packed}, \
+                 {cordic_rotate_##I##_##C##_##R##_##Z##_paired, cordic_rotate_##I##_##C##_##R##_##Z##_branch_free_paired}}, \
+    cordic_angles_##I##_##C##_##R##_##Z}
+
+static const struct {
+   int index_bits, cordic_bits, cordic_reps, z_extra_bits;
+   cordic_rotate_fn rotate[CORDIC_STORAGES][CORDIC_KERNELS];
+   void (*angles)(int32_t *angles);     /* The angles built into it */
+} specialized[] = {
+   CORDIC_SPECIALIZED(11, 19, 24, 2),
+   CORDIC_SPECIALIZED( 9, 14, 18, 2),
+   CORDIC_SPECIALIZED( 7, 13, 16, 2),
+};
+
+const char *cordic_kernel_names[CORDIC_KERNELS]   = {"default", "branch-free"};
+const char *cordic_storage_names[CORDIC_STORAGES] = {"wide", "packed", "paired"};
+const char *cordic_page_names[CORDIC_PAGE_KINDS]  = {"auto", "normal", "huge"};
+
+/***************************************************************
+ * The tables that grow with INDEX_BITS are mapped rather than
+ * malloc()ed, so that they can be given huge pages: with
+ * CORDIC_PAGES_AUTO the kernel is asked for transparent huge
+ * pages once a table is big enough to use one, and with
+ * CORDIC_PAGES_HUGE they must come from the reserved huge pages
+ **************************************************************/
+static size_t table_length(const struct cordic_config *cfg, size_t bytes) {
+   if(cfg->pages == CORDIC_PAGES_HUGE)
+     return (bytes + HUGE_PAGE_SIZE-1) & ~(HUGE_PAGE_SIZE-1);
+   return bytes;
+}
+
+static void *table_alloc(const struct cordic_config *cfg, size_t bytes) {
+   int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+   void *p;
+
+#ifdef MAP_HUGETLB
+   if(cfg->pages == CORDIC_PAGES_HUGE)
+     flags |= MAP_HUGETLB;
+#endif
+   p = mmap(NULL, table_length(cfg, bytes), PROT_READ | PROT_WRITE, flags, -1, 0);
+   if(p == MAP_FAILED)
+     return NULL;
+#ifdef MADV_HUGEPAGE
+   if(cfg->pages == CORDIC_PAGES_AUTO && bytes >= HUGE_PAGE_SIZE)
+     madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+   return p;
+}
+
+static void table_free(const struct cordic_config *cfg, const void *p, size_t bytes) {
+   if(p != NULL)
+     munmap((void *)p, table_length(cfg, bytes));
+}
+
+/* The bytes taken by each of the tables */
+#define INITIAL_BYTES(cfg)    ((cfg)->table_size * sizeof(int64_t))
+#define INITIAL32_BYTES(cfg)  ((cfg)->table_size * sizeof(int32_t))
+#define PACKED_BYTES(cfg)     (5*(cfg)->table_size + 3)
+#define PAIRED_BYTES(cfg)     ((cfg)->table_size * sizeof(int64_t))
+
+static void no_table_memory(const struct cordic_config *cfg) {
+   if(cfg->pages == CORDIC_PAGES_HUGE)
+     fprintf(stderr, "Unable to get huge pages for the tables (see /proc/sys/vm/nr_hugepages)\n");
+   else
+     fprintf(stderr, "Out of memory\n");
+}
+
+/***************************************************************
+ * Working out initial[] is split across threads once the table is
+ * big enough for it to be worth starting them. Each entry is worked
+ * out exactly as it would be by one thread, so the results are the
+ * same bit for bit.
+ **************************************************************/
+#define TABLE_THREAD_MIN   ((int64_t)1<<16)   /* Entries before threads are used */
+#define TABLE_THREADS_MAX  (64)
+
+struct table_job {
+   pthread_t thread;
+   int64_t   start, end;
+   int64_t  *initial;
+   int32_t  *initial32;          /* NULL if not narrow */
+   double    magnitude, table_angle, half_table_angle, offset;
+};
+
+static void *table_thread(void *arg) {
+   struct table_job *job = arg;
+   int64_t i;
+
+   for(i = job->start; i < job->end; i++) {
+     job->initial[i] = (int64_t)(job->magnitude * sin(job->table_angle * i + job->half_table_angle)-job->offset);
+     if(job->initial32)
+       job->initial32[i] = job->initial[i];
+   }
+   return NULL;
+}
+
+/* Returns how many threads were used */
+static int fill_initial(const struct cordic_config *cfg, int64_t *initial, int32_t *initial32, double magnitude,
+                        double table_angle, double half_table_angle) {
+   struct table_job jobs[TABLE_THREADS_MAX];
+   long threads = cfg->threads > 0 ? cfg->threads : sysconf(_SC_NPROCESSORS_ONLN);
+   int i, started = 0;
+
+   if(threads < 1 || cfg->table_size < TABLE_THREAD_MIN)
+     threads = 1;
+   if(threads > TABLE_THREADS_MAX)
+     threads = TABLE_THREADS_MAX;
+
+   for(i = 0; i < threads; i++) {
+     jobs[i].start            = cfg->table_size * i / threads;
+     jobs[i].end              = cfg->table_size * (i+1) / threads;
+     jobs[i].initial          = initial;
+     jobs[i].initial32        = initial32;
+     jobs[i].magnitude        = magnitude;
+     jobs[i].table_angle      = table_angle;
+     jobs[i].half_table_angle = half_table_angle;
+     jobs[i].offset           = pow(2,cfg->output_extra_bits-1);
+   }
+   /* The first part is done here. If a thread can't be started its part is too */
+   for(i = 1; i < threads; i++) {
+     if(pthread_create(&jobs[i].thread, NULL, table_thread, &jobs[i]) != 0)
+       break;
+     started++;
+   }
+   table_thread(&jobs[0]);
+   for(i = started+1; i < threads; i++)
+     table_thread(&jobs[i]);
+   for(i = 1; i <= started; i++)
+     pthread_join(jobs[i].thread, NULL);
+   return threads;
+}
+
+/****************************************************************
+ * Calculate the tables for the CORDIC sin()/cos() function
+ ***************************************************************/
+static int make_tables(struct cordic_config *cfg) {
+   int i, start_shifts;
+   double scale = pow(0.5,0.5);
+   double table_angle, half_table_angle;
+   double cordic_start;
+   double table_magnitude;
+   int32_t *angles, *shifts, *initial32 = NULL;
+   int64_t *initial;
+   double start;
+   int threads;
+
+   angles  = malloc(cfg->cordic_reps * sizeof(int32_t));
+   shifts  = malloc(cfg->cordic_reps * sizeof(int32_t));
+   initial = table_alloc(cfg, INITIAL_BYTES(cfg));
+   if(cfg->narrow)
+     initial32 = table_alloc(cfg, INITIAL32_BYTES(cfg));
+   cfg->angles    = angles;
+   cfg->shifts    = shifts;
+   cfg->initial   = initial;
+   cfg->initial32 = initial32;
+   if(angles == NULL || shifts == NULL || initial == NULL || (cfg->narrow && initial32 == NULL)) {
+     no_table_memory(cfg);
+     cordic_free(cfg);
+     return -1;
+   }
+
+   table_angle      = PI / 2.0 / cfg->table_size;
+   half_table_angle = table_angle / 2.0;
+
+   cordic_start     = cordic_start_bits(cfg->index_bits);
+   start_shifts     = ceil(cordic_start);
+   if(cfg->verbose)
+     printf("Starting CORDIC at lest %13.11f => %i shifts\n", cordic_start, start_shifts);
+
+   scale = 1.0;
+   for(i = 0; i < cfg->cordic_reps; i++ ) {
+     double angle = cordic_angle_radians(cfg->index_bits, i);
+     double a     = cordic_angle(cfg->index_bits, cfg->cordic_bits, cfg->z_extra_bits, i);
+
+     if(a >= INT32_MAX) {
+       if(cfg->verbose)
+         fprintf(stderr, "Invalid CORDIC configuration, angle[%i] is too large\n", i);
+       cordic_free(cfg);
+       return -1;
+     }
+     angles[i] = a;
+     shifts[i] = cfg->index_bits+i;
+     if(i >= cfg->hybrid_bits && (cfg->tail_from == 0 || i < cfg->tail_from))
+       scale  *= cos(angle);
+     if(cfg->verbose)
+       printf("angle[%i] = %i\n",i, angles[i]);
+   }
+   table_magnitude = (cfg->output_scale * scale)*pow(2,cfg->output_extra_bits);
+
+   /* The hybrid engine's first order step stretches the seeds by
+    * sqrt(1+delta^2), so take out the average stretch */
+   if(cfg->hybrid_bits > 0) {
+     double stretch = 0.0;
+     int64_t k;
+
+     for(k = 1-((int64_t)1<<cfg->hybrid_bits); k < ((int64_t)1<<cfg->hybrid_bits); k += 2)
+       stretch += sqrt(1.0 + pow(k * PI / pow(2, cfg->index_bits+cfg->hybrid_bits+2), 2));
+     table_magnitude /= stretch / ((int64_t)1<<cfg->hybrid_bits);
+   }
+
+   start   = seconds();
+   threads = fill_initial(cfg, initial, initial32, table_magnitude, table_angle, half_table_angle);
+   cfg->table_seconds = seconds() - start;
+   if(cfg->verbose)
+     printf("initial[] took %.3f ms with %i thread%s\n", cfg->table_seconds*1e3, threads, threads > 1 ? "s" : "");
+
+   /* deriv[] for the hybrid engine, with as many fraction bits as
+    * leave k*deriv[i] clear of overflow */
+   if(cfg->hybrid_bits > 0) {
+     int64_t *deriv = table_alloc(cfg, INITIAL_BYTES(cfg));
+     int bits;
+
+     if(deriv == NULL) {
+       no_table_memory(cfg);
+       cordic_free(cfg);
+       return -1;
+     }
+     for(bits = 1; ((cfg->output_scale << cfg->output_extra_bits) >> bits) != 0; bits++)
+       ;
+     cfg->hybrid_shift = 62 - bits + cfg->index_bits;
+     if(cfg->hybrid_shift > 62)
+       cfg->hybrid_shift = 62;
+     for(i = 0; i < cfg->table_size; i++)
+       deriv[i] = llround(ldexp(initial[i] * PI, cfg->hybrid_shift - (cfg->index_bits+cfg->hybrid_bits+2)));
+     cfg->deriv = deriv;
+   }
+
+   /* Pack each entry into 5 bytes, with 3 spare at the end so the last can be read as 8 */
+   if(cfg->storage == CORDIC_STORAGE_PACKED) {
+     uint8_t *packed = table_alloc(cfg, PACKED_BYTES(cfg));
+
+     if(packed == NULL) {
+       no_table_memory(cfg);
+       cordic_free(cfg);
+       return -1;
+     }
+     for(i = 0; i < cfg->table_size; i++) {
+       int b;
+       for(b = 0; b < 5; b++)
+         packed[5*i+b] = (uint64_t)initial[i] >> (8*b);
+     }
+     table_free(cfg, initial, INITIAL_BYTES(cfg));
+     cfg->initial     = NULL;
+     cfg->packed      = packed;
+     cfg->table_bytes = 5*cfg->table_size;
+   } else if(cfg->storage == CORDIC_STORAGE_PAIRED) {
+     /* Each mirrored pair in 16 aligned bytes, so in one cache line */
+     int64_t *paired = table_alloc(cfg, PAIRED_BYTES(cfg));
+
+     if(paired == NULL) {
+       no_table_memory(cfg);
+       cordic_free(cfg);
+       return -1;
+     }
+     for(i = 0; i < cfg->table_size/2; i++) {
+       paired[2*i]   = initial[i];
+       paired[2*i+1] = initial[cfg->table_size-1-i];
+     }
+     table_free(cfg, initial, INITIAL_BYTES(cfg));
+     cfg->initial     = NULL;
+     cfg->paired      = paired;
+     cfg->table_bytes = cfg->table_size * sizeof(int64_t);
+   } else {
+     cfg->table_bytes = cfg->table_size * sizeof(int64_t);
+   }
+
+   if(cfg->verbose && angles[0] == angles[cfg->cordic_reps-1]) {
+      printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+      printf("!! NOTE = All entries in 'angles' are the same, so a constant can be used     !!!\n");
+      printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n\n");
+   }
+   return 0;
+}
+
+/***************************************************************
+ * A table file holds the tables for one configuration, so they
+ * can be mapped read-only and shared by every process using it
+ * rather than worked out by each. The header is followed by
+ * angles[] and shifts[], then initial[] (held however 'storage'
+ * says) and initial32[] if narrow, each starting on a page.
+ **************************************************************/
+#define TABLE_FILE_MAGIC    "ECTABLE"
+#define TABLE_FILE_VERSION  (1)
+#define TABLE_FILE_ALIGN    ((int64_t)4096)
+
+struct table_file_header {
+   char    magic[8];
+   int32_t version;
+   int32_t index_bits, cordic_bits, cordic_reps, output_extra_bits, z_extra_bits, storage, narrow;
+   int64_t output_scale;
+   int64_t table_offset, table_bytes, initial32_offset, file_bytes;
+};
+
+static void table_file_layout(const struct cordic_config *cfg, struct table_file_header *h) {
+   memset(h, 0, sizeof(*h));
+   memcpy(h->magic, TABLE_FILE_MAGIC, sizeof(h->magic));
+   h->version           = TABLE_FILE_VERSION;
+   h->index_bits        = cfg->index_bits;
+   h->cordic_bits       = cfg->cordic_bits;
+   h->cordic_reps       = cfg->cordic_reps;
+   h->output_extra_bits = cfg->output_extra_bits;
+   h->z_extra_bits      = cfg->z_extra_bits;
+   h->storage           = cfg->storage;
+   h->narrow            = cfg->narrow;
+   h->output_scale      = cfg->output_scale;
+   h->table_bytes       = cfg->storage == CORDIC_STORAGE_PACKED ? PACKED_BYTES(cfg) : INITIAL_BYTES(cfg);
+   h->table_offset      = (sizeof(*h) + 2*cfg->cordic_reps*sizeof(int32_t) + TABLE_FILE_ALIGN-1) & ~(TABLE_FILE_ALIGN-1);
+   h->file_bytes        = h->table_offset + h->table_bytes;
+   if(cfg->narrow) {
+     h->initial32_offset = (h->file_bytes + TABLE_FILE_ALIGN-1) & ~(TABLE_FILE_ALIGN-1);
+     h->file_bytes       = h->initial32_offset + INITIAL32_BYTES(cfg);
+   }
+}
+
+/* Write the tables just made, under a temporary name then renamed, so others never see half a file */
+static int write_table_file(const struct cordic_config *cfg) {
+   struct table_file_header h;
+   const void *table = cfg->storage == CORDIC_STORAGE_PACKED ? (const void *)cfg->packed :
+                       cfg->storage == CORDIC_STORAGE_PAIRED ? (const void *)cfg->paired : (const void *)cfg->initial;
+   char *temp = malloc(strlen(cfg->table_file) + 32);
+   FILE *f;
+   int ok;
+
+   if(temp == NULL) {
+     fprintf(stderr, "Out of memory\n");
+     return -1;
+   }
+   sprintf(temp, "%s.%li.tmp", cfg->table_file, (long)getpid());
+   table_file_layout(cfg, &h);
+   f = fopen(temp, "wb");
+   if(f == NULL) {
+     fprintf(stderr, "Unable to write '%s'\n", temp);
+     free(temp);
+     return -1;
+   }
+   ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(cfg->angles, sizeof(int32_t), cfg->cordic_reps, f) == (size_t)cfg->cordic_reps &&
+        fwrite(cfg->shifts, sizeof(int32_t), cfg->cordic_reps, f) == (size_t)cfg->cordic_reps &&
+        fseek(f, h.table_offset, SEEK_SET) == 0 &&
+        fwrite(table, 1, h.table_bytes, f) == (size_t)h.table_bytes;
+   if(ok && cfg->narrow)
+     ok = fseek(f, h.initial32_offset, SEEK_SET) == 0 &&
+          fwrite(cfg->initial32, sizeof(int32_t), cfg->table_size, f) == (size_t)cfg->table_size;
+   if(fclose(f) != 0)
+     ok = 0;
+   if(!ok || rename(temp, cfg->table_file) != 0) {
+     fprintf(stderr, "Unable to write '%s'\n", cfg->table_file);
+     remove(temp);
+     free(temp);
+     return -1;
+   }
+   free(temp);
+   return 0;
+}
+
+/* Map the tables from cfg->table_file, making it first if it doesn't exist */
+static int map_table_file(struct cordic_config *cfg) {
+   struct table_file_header want, *h;
+   struct stat st;
+   uint8_t *base;
+   int fd;
+
+   fd = open(cfg->table_file, O_RDONLY);
+   if(fd < 0 && errno == ENOENT) {
+     if(make_tables(cfg) != 0)
+       return -1;
+     if(write_table_file(cfg) != 0) {
+       cordic_free(cfg);
+       return -1;
+     }
+     cordic_free(cfg);
+     if(cfg->verbose)
+       printf("Wrote the tables to '%s'\n", cfg->table_file);
+     fd = open(cfg->table_file, O_RDONLY);
+   }
+   if(fd < 0 || fstat(fd, &st) != 0) {
+     fprintf(stderr, "Unable to read '%s'\n", cfg->table_file);
+     if(fd >= 0)
+       close(fd);
+     return -1;
+   }
+
+   table_file_layout(cfg, &want);
+   if(st.st_size != want.file_bytes) {
+     fprintf(stderr, "'%s' is not a table file for this configuration\n", cfg->table_file);
+     close(fd);
+     return -1;
+   }
+   base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(base == MAP_FAILED) {
+     fprintf(stderr, "Unable to map '%s'\n", cfg->table_file);
+     return -1;
+   }
+   h = (struct table_file_header *)base;
+   if(memcmp(h, &want, sizeof(want)) != 0) {
+     fprintf(stderr, "'%s' is not a table file for this configuration\n", cfg->table_file);
+     munmap(base, st.st_size);
+     return -1;
+   }
+
+   cfg->mapped       = base;
+   cfg->mapped_bytes = st.st_size;
+   cfg->angles       = (const int32_t *)(base + sizeof(*h));
+   cfg->shifts       = cfg->angles + cfg->cordic_reps;
+   cfg->table_bytes  = cfg->storage == CORDIC_STORAGE_PACKED ? 5*cfg->table_size : INITIAL_BYTES(cfg);
+   switch(cfg->storage) {
+     case CORDIC_STORAGE_PACKED: cfg->packed  = base + h->table_offset;                    break;
+     case CORDIC_STORAGE_PAIRED: cfg->paired  = (const int64_t *)(base + h->table_offset); break;
+     default:                    cfg->initial = (const int64_t *)(base + h->table_offset); break;
+   }
+   if(cfg->narrow)
+     cfg->initial32 = (const int32_t *)(base + h->initial32_offset);
+   if(cfg->verbose)
+     printf("Mapped the tables from '%s'\n", cfg->table_file);
+   return 0;
+}
+
+/****************************************************************
+ * Calculate the values required for CORDIC sin()/cos() function
+ ***************************************************************/
+int setup(struct cordic_config *cfg) {
+   int i;
+
+   cfg->angles = cfg->shifts = cfg->initial32 = NULL;
+   cfg->initial = NULL;
+   cfg->packed = NULL;
+   cfg->paired = NULL;
+   cfg->mapped = NULL;
+   cfg->deriv = NULL;
+   cfg->built_in = 0;
+   cfg->table_seconds = 0.0;
+
+   /* These bound the shifts in the checks below and in the rotation, so come first */
+   if(cfg->output_extra_bits > 60) {
+     if(cfg->verbose)
+       fprintf(stderr, "Invalid CORDIC configuration, output_extra_bits is above 60\n");
+     return -1;
+   }
+   if(cfg->cordic_bits + cfg->z_extra_bits + cfg->cordic_reps > 62) {
+     if(cfg->verbose)
+       fprintf(stderr, "Invalid CORDIC configuration, cordic_bits+z_extra_bits+cordic_reps is above 62\n");
+     return -1;
+   }
+
+   if(cfg->index_bits < 1 || cfg->index_bits > 30 || cfg->cordic_bits < 1 ||
+      cfg->index_bits + cfg->cordic_bits > 60 || cfg->cordic_reps < 1 ||
+      cfg->index_bits + cfg->cordic_reps > 63 || cfg->z_extra_bits < 1 ||
+      cfg->output_extra_bits < 0 || cfg->output_scale < 1 ||
+      cfg->output_scale > ((int64_t)1<<(60-cfg->output_extra_bits)) ||
+      cfg->kernel < 0 || cfg->kernel >= CORDIC_KERNELS || cfg->storage < 0 || cfg->storage >= CORDIC_STORAGES ||
+      cfg->pages < 0 || cfg->pages >= CORDIC_PAGE_KINDS || cfg->hybrid_bits < 0 ||
+      (cfg->hybrid_bits > 0 && (cfg->hybrid_bits >= cfg->cordic_reps || cfg->storage != CORDIC_STORAGE_WIDE ||
+                                cfg->hybrid_bits >= cfg->cordic_bits+cfg->z_extra_bits)) ||
+      cfg->tail_from < 0 || cfg->tail_from > cfg->cordic_reps ||
+      (cfg->tail_from > 0 && cfg->tail_from <= cfg->hybrid_bits) ||
+      (cfg->storage == CORDIC_STORAGE_PACKED && (cfg->output_scale << cfg->output_extra_bits) >= ((int64_t)1<<39))) {
+     if(cfg->verbose)
+       fprintf(stderr, "Invalid CORDIC configuration\n");
+     return -1;
+   }
+   /* The table file doesn't hold deriv[], or initial[] scaled for fewer iterations */
+   if(cfg->table_file != NULL && (cfg->hybrid_bits > 0 || cfg->tail_from > 0)) {
+     if(cfg->verbose)
+       fprintf(stderr, "Invalid CORDIC configuration, a table file can't be used with the hybrid engine or the "
+                       "multiply tail\n");
+     return -1;
+   }
+
+   cfg->input_bits  = 2+cfg->index_bits+cfg->cordic_bits;
+   cfg->full_circle = (int64_t)1<<cfg->input_bits;
+   cfg->table_size  = (int64_t)1<<cfg->index_bits;
+   cfg->cordic_mask = ((int64_t)1<<cfg->cordic_bits)-1;
+   cfg->index_mask  = (cfg->table_size-1) << cfg->cordic_bits;
+   cfg->target      = (int64_t)1<<(cfg->cordic_bits+cfg->z_extra_bits-1);
+
+   /* Can x, y and z be held in 32 bits? x and y peak at about
+    * output_scale<<output_extra_bits, so one bit is kept spare for
+    * rounding, and z stays within a few times 2^(cordic_bits+z_extra_bits) */
+   cfg->narrow = cfg->input_bits <= 32 && cfg->cordic_bits+cfg->z_extra_bits+3 <= 31 &&
+                 (cfg->output_scale << cfg->output_extra_bits) <= ((int64_t)1<<30);
+
+#ifdef CORDIC_TABLES
+   /* Use the tables from gen_tables if they are for this configuration */
+   if(cfg->index_bits   == CORDIC_TABLES_INDEX_BITS   && cfg->cordic_bits       == CORDIC_TABLES_CORDIC_BITS &&
+      cfg->cordic_reps  == CORDIC_TABLES_CORDIC_REPS  && cfg->output_scale      == CORDIC_TABLES_OUTPUT_SCALE &&
+      cfg->z_extra_bits == CORDIC_TABLES_Z_EXTRA_BITS && cfg->output_extra_bits == CORDIC_TABLES_OUTPUT_EXTRA_BITS &&
+      cfg->storage == CORDIC_STORAGE_WIDE && cfg->hybrid_bits == 0 && cfg->tail_from == 0) {
+     cfg->angles   = cordic_table_angles;
+     cfg->shifts   = cordic_table_shifts;
+     cfg->initial  = cordic_table_initial;
+#if CORDIC_TABLES_NARROW
+     cfg->initial32 = cordic_table_initial32;
+#endif
+     cfg->table_bytes = sizeof(cordic_table_initial);
+     cfg->built_in = 1;
+     /* Always said when there was a table file asked for, as it isn't used */
+     if(cfg->table_file != NULL)
+       fprintf(stderr, "Using the tables built in from cordic_tables.h, not '%s'\n", cfg->table_file);
+     else if(cfg->verbose)
+       printf("Using the tables built in from cordic_tables.h\n");
+   } else
+#endif
+   if(cfg->table_file != NULL) {
+     if(map_table_file(cfg) != 0)
+       return -1;
+   } else if(make_tables(cfg) != 0) {
+     return -1;
+   }
+
+   /* The multiply tail's z to radians scale, with as many fraction bits
+    * as leave z*tail_scale and the radians times x or y clear of overflow */
+   if(cfg->tail_from > 0) {
+     int t = cfg->index_bits + cfg->tail_from, bits;
+
+     for(bits = 1; ((cfg->output_scale << cfg->output_extra_bits) >> bits) != 0; bits++)
+       ;
+     cfg->tail_shift       = 59 - bits + t;
+     if(cfg->tail_shift > 62)
+       cfg->tail_shift = 62;
+     cfg->tail_scale_shift = 59 - cfg->tail_shift + t;
+     if(cfg->tail_scale_shift < 0)
+       cfg->tail_scale_shift = 0;
+     cfg->tail_scale = llround(ldexp(PI, cfg->tail_shift + cfg->tail_scale_shift -
+                                         (1 + t + cfg->cordic_bits + cfg->z_extra_bits)));
+     if(cfg->verbose)
+       printf("Multiply tail after %i iterations, z*%li>>%i radians with %i fraction bits\n",
+              cfg->tail_from, cfg->tail_scale, cfg->tail_scale_shift, cfg->tail_shift);
+   }
+
+   cfg->rotate = cfg->hybrid_bits > 0 ? hybrid[cfg->tail_from > 0][cfg->kernel]
+                                      : generic[cfg->tail_from > 0][cfg->storage][cfg->kernel];
+   for(i = 0; !cfg->generic && cfg->hybrid_bits == 0 && cfg->tail_from == 0 &&
+              i < (int)(sizeof(specialized)/sizeof(specialized[0])); i++) {
+     if(specialized[i].index_bits   == cfg->index_bits   && specialized[i].cordic_bits  == cfg->cordic_bits &&
+        specialized[i].cordic_reps  == cfg->cordic_reps  && specialized[i].z_extra_bits == cfg->z_extra_bits) {
+       int32_t built_in[64];
+
+       specialized[i].angles(built_in);
+       if(memcmp(built_in, cfg->angles, cfg->cordic_reps * sizeof(int32_t)) == 0)
+         cfg->rotate = specialized[i].rotate[cfg->storage][cfg->kernel];
+       else if(cfg->verbose)
+         printf("The specialized rotation's angles don't match angles[], so it isn't used\n");
+     }
+   }
+   return 0;
+}
+
+void cordic_free(struct cordic_config *cfg) {
+   if(cfg->mapped != NULL) {
+     munmap(cfg->mapped, cfg->mapped_bytes);
+   } else if(!cfg->built_in) {
+     free((void *)cfg->angles);
+     free((void *)cfg->shifts);
+     table_free(cfg, cfg->initial,   INITIAL_BYTES(cfg));
+     table_free(cfg, cfg->initial32, INITIAL32_BYTES(cfg));
+     table_free(cfg, cfg->packed,    PACKED_BYTES(cfg));
+     table_free(cfg, cfg->paired,    PAIRED_BYTES(cfg));
+     table_free(cfg, cfg->deriv,     INITIAL_BYTES(cfg));
+   }
+   cfg->mapped = NULL;
+   cfg->angles = cfg->shifts = cfg->initial32 = NULL;
+   cfg->initial = NULL;
+   cfg->packed = NULL;
+   cfg->paired = NULL;
+   cfg->deriv = NULL;
+}
+
+/* Apply the quadrant's signs to the rotation, and remove the extra bits */
+static inline void cordic_output(const struct cordic_config *cfg, int64_t z, int64_t x, int64_t y,
+                                 int64_t *s, int64_t *c) {
+   int8_t flip_sin_sign, flip_cos_sign, quadrant_bit0, quadrant_bit1;
+
+   quadrant_bit1 = (z >> (cfg->cordic_bits+cfg->index_bits+1)) & 1;
+   quadrant_bit0 = (z >> (cfg->cordic_bits+cfg->index_bits  )) & 1;
+
+   /* Sort out hot to respond to the quadrant we are in */
+   flip_sin_sign = quadrant_bit1;
+   flip_cos_sign = quadrant_bit1 ^ quadrant_bit0;
+
+   *c = (flip_cos_sign  ? -x : x)>>cfg->output_extra_bits;
+   *s = (flip_sin_sign ? -y : y)>>cfg->output_extra_bits;
+}
+
+/* The same, with masks rather than selects */
+static inline void cordic_output_branch_free(const struct cordic_config *cfg, int64_t z, int64_t x, int64_t y,
+                                             int64_t *s, int64_t *c) {
+   int64_t quadrant_bit1 = (z >> (cfg->cordic_bits+cfg->index_bits+1)) & 1;
+   int64_t quadrant_bit0 = (z >> (cfg->cordic_bits+cfg->index_bits  )) & 1;
+   int64_t flip_sin_mask = -quadrant_bit1;
+   int64_t flip_cos_mask = -(quadrant_bit1 ^ quadrant_bit0);
+
+   *c = ((x ^ flip_cos_mask) - flip_cos_mask)>>cfg->output_extra_bits;
+   *s = ((y ^ flip_sin_mask) - flip_sin_mask)>>cfg->output_extra_bits;
+}
+
+/***************************************************************
+ * Cordic routine to calculate Sine and Cosine for angles
+ * with 2^input_bits representing the full circle
+ **************************************************************/
+void cordic_sine_cosine(const struct cordic_config *cfg, int64_t z, int64_t *s, int64_t *c) {
+   int64_t x, y;
+
+   cfg->rotate(cfg, z, &x, &y);
+   if(cfg->kernel == CORDIC_KERNEL_BRANCH_FREE)
+     cordic_output_branch_free(cfg, z, x, y, s, c);
+   else
+     cordic_output(cfg, z, x, y, s, c);
+}
+
+/***************************************************************
+ * The same as cordic_sine_cosine(), but also recording the
+ * working into 'trace', which must have room for cordic_reps+1
+ * records
+ **************************************************************/
+void cordic_sine_cosine_trace(const struct cordic_config *cfg, int64_t z, int64_t *s, int64_t *c,
+                              struct cordic_trace_record *trace) {
+   int64_t x, y;
+
+   if(cfg->hybrid_bits > 0) {
+     cordic_rotate_body(cfg, cfg->index_bits, cfg->cordic_bits, cfg->cordic_reps, cfg->z_extra_bits, 0, 0,
+                        CORDIC_STORAGE_WIDE, 1, cfg->tail_from > 0, z, &x, &y, trace);
+   } else {
+     switch(cfg->storage) {
+       case CORDIC_STORAGE_PACKED:
+         cordic_rotate_body(cfg, cfg->index_bits, cfg->cordic_bits, cfg->cordic_reps, cfg->z_extra_bits, 0, 0,
+                            CORDIC_STORAGE_PACKED, 0, cfg->tail_from > 0, z, &x, &y, trace);
+         break;
+       case CORDIC_STORAGE_PAIRED:
+         cordic_rotate_body(cfg, cfg->index_bits, cfg->cordic_bits, cfg->cordic_reps, cfg->z_extra_bits, 0, 0,
+                            CORDIC_STORAGE_PAIRED, 0, cfg->tail_from > 0, z, &x, &y, trace);
+         break;
+       default:
+         cordic_rotate_body(cfg, cfg->index_bits, cfg->cordic_bits, cfg->cordic_reps, cfg->z_extra_bits, 0, 0,
+                            CORDIC_STORAGE_WIDE, 0, cfg->tail_from > 0, z, &x, &y, trace);
+         break;
+     }
+   }
+   cordic_output(cfg, z, x, y, s, c);
+}
+
+void print_trace(const struct cordic_config *cfg, const struct cordic_trace_record *trace) {
+   int i;
+
+   printf("      SIN        COS        Z\n");
+   for(i = 0; i <= cfg->cordic_reps; i++)
+     printf("%10li, %10li, %10li\n", trace[i].y, trace[i].x, trace[i].z);
+}
+
+#ifdef HAVE_X86_SIMD
+/***************************************************************
+ * AVX2 helpers. AVX2 has no 64-bit arithmetic right shift, so
+ * flip negative values, shift logically and flip them back
+ **************************************************************/
+__attribute__((target("avx2")))
+static inline __m256i srai64_avx2(__m256i v, __m128i count) {
+   __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), v);
+   return _mm256_xor_si256(_mm256_srl_epi64(_mm256_xor_si256(v, sign), count), sign);
+}
+
+/* Negate the lanes where 'mask' is all ones */
+__attribute__((target("avx2")))
+static inline __m256i negate_if_avx2(__m256i v, __m256i mask) {
+   return _mm256_sub_epi64(_mm256_xor_si256(v, mask), mask);
+}
+
+/***************************************************************
+ * cordic_sine_cosine() for four phases at a time, in 64-bit lanes
+ **************************************************************/
+__attribute__((target("avx2")))
+static void cordic_sine_cosine_avx2(const struct cordic_config *cfg, const int64_t *zp,
+                                    int64_t *s, int64_t *c, size_t n) {
+   const __m256i one         = _mm256_set1_epi64x(1);
+   const __m256i index_mask  = _mm256_set1_epi64x(cfg->index_mask);
+   const __m256i cordic_mask = _mm256_set1_epi64x(cfg->cordic_mask);
+   const __m256i last_index  = _mm256_set1_epi64x(cfg->table_size-1);
+   const __m256i z_full      = _mm256_set1_epi64x((int64_t)1<<(cfg->cordic_bits+cfg->z_extra_bits));
+   const __m256i target      = _mm256_set1_epi64x(cfg->target);
+   const __m128i bit0_shift  = _mm_cvtsi32_si128(cfg->cordic_bits+cfg->index_bits);
+   const __m128i bit1_shift  = _mm_cvtsi32_si128(cfg->cordic_bits+cfg->index_bits+1);
+   const __m128i index_shift = _mm_cvtsi32_si128(cfg->cordic_bits);
+   const __m128i z_shift     = _mm_cvtsi32_si128(cfg->z_extra_bits);
+   const __m128i out_shift   = _mm_cvtsi32_si128(cfg->output_extra_bits);
+   const __m128i pack_shift  = _mm_cvtsi32_si128(24);
+   const __m256i half_last   = _mm256_set1_epi64x(cfg->table_size/2-1);
+   size_t j;
+
+   for(j = 0; j+4 <= n; j += 4) {
+     __m256i z, x, y, index, a, b, quadrant_bit0, quadrant_bit1, flip_sin, flip_cos;
+     int i;
+
+     /* Split into sections, turning the quadrant bits into lane masks */
+     z             = _mm256_loadu_si256((const __m256i *)(zp+j));
+     quadrant_bit1 = _mm256_and_si256(_mm256_srl_epi64(z, bit1_shift), one);
+     quadrant_bit0 = _mm256_and_si256(_mm256_srl_epi64(z, bit0_shift), one);
+     quadrant_bit1 = _mm256_sub_epi64(_mm256_setzero_si256(), quadrant_bit1);
+     quadrant_bit0 = _mm256_sub_epi64(_mm256_setzero_si256(), quadrant_bit0);
+     index         = _mm256_srl_epi64(_mm256_and_si256(z, index_mask), index_shift);
+     z             = _mm256_sll_epi64(_mm256_and_si256(z, cordic_mask), z_shift);
+
+     flip_sin = quadrant_bit1;
+     flip_cos = _mm256_xor_si256(quadrant_bit1, quadrant_bit0);
+
+     z = _mm256_blendv_epi8(z, _mm256_sub_epi64(z_full, z), quadrant_bit0);
+     z = _mm256_sub_epi64(z, target);
+
+     /* Both table reads are gathers, and swapped with a blend. Packed
+      * entries are gathered as 8 bytes from index*5 and sign extended */
+     if(cfg->storage == CORDIC_STORAGE_PACKED) {
+       __m256i mirror = _mm256_sub_epi64(last_index, index);
+
+       a = _mm256_i64gather_epi64((const long long *)cfg->packed,
+                                  _mm256_add_epi64(_mm256_slli_epi64(index, 2), index), 1);
+       b = _mm256_i64gather_epi64((const long long *)cfg->packed,
+                                  _mm256_add_epi64(_mm256_slli_epi64(mirror, 2), mirror), 1);
+       a = srai64_avx2(_mm256_slli_epi64(a, 24), pack_shift);
+       b = srai64_avx2(_mm256_slli_epi64(b, 24), pack_shift);
+     } else if(cfg->storage == CORDIC_STORAGE_PAIRED) {
+       /* Read the pair for the first half index, swapping them back for the second half */
+       __m256i top  = _mm256_cmpgt_epi64(index, half_last);
+       __m256i pair = _mm256_slli_epi64(_mm256_xor_si256(index, _mm256_and_si256(top, last_index)), 1);
+       __m256i lo   = _mm256_i64gather_epi64((const long long *)cfg->paired, pair, 8);
+       __m256i hi   = _mm256_i64gather_epi64((const long long *)cfg->paired, _mm256_add_epi64(pair, one), 8);
+
+       a = _mm256_blendv_epi8(lo, hi, top);
+       b = _mm256_blendv_epi8(hi, lo, top);
+     } else {
+       a = _mm256_i64gather_epi64((const long long *)cfg->initial, index, 8);
+       b = _mm256_i64gather_epi64((const long long *)cfg->initial, _mm256_sub_epi64(last_index, index), 8);
+     }
+     x = _mm256_blendv_epi8(b, a, quadrant_bit0);
+     y = _mm256_blendv_epi8(a, b, quadrant_bit0);
+
+     for(i = 0; i < cfg->cordic_reps; i++ ) {
+       __m128i shift = _mm_cvtsi32_si128(cfg->shifts[i]);
+       __m256i tx    = srai64_avx2(x, shift);
+       __m256i ty    = srai64_avx2(y, shift);
+       __m256i neg   = _mm256_cmpgt_epi64(_mm256_setzero_si256(), z);
+
+       x = _mm256_sub_epi64(x, negate_if_avx2(ty, neg));
+       y = _mm256_add_epi64(y, negate_if_avx2(tx, neg));
+       z = _mm256_sub_epi64(z, negate_if_avx2(_mm256_set1_epi64x(cfg->angles[i]), neg));
+       z = _mm256_slli_epi64(z, 1);
+     }
+     _mm256_storeu_si256((__m256i *)(c+j), srai64_avx2(negate_if_avx2(x, flip_cos), out_shift));
+     _mm256_storeu_si256((__m256i *)(s+j), srai64_avx2(negate_if_avx2(y, flip_sin), out_shift));
+   }
+}
+
+/***************************************************************
+ * cordic_sine_cosine() for sixteen phases at a time, with x, y
+ * and z held in 32-bit lanes. Only used if setup() found that the
+ * configuration is narrow enough.
+ **************************************************************/
+__attribute__((target("avx512f")))
+static void cordic_sine_cosine_avx512_narrow(const struct cordic_config *cfg, const int64_t *zp,
+                                             int64_t *s, int64_t *c, size_t n) {
+   const __m512i zero        = _mm512_setzero_si512();
+   const __m512i index_mask  = _mm512_set1_epi32(cfg->index_mask);
+   const __m512i cordic_mask = _mm512_set1_epi32(cfg->cordic_mask);
+   const __m512i last_index  = _mm512_set1_epi32(cfg->table_size-1);
+   const __m512i z_full      = _mm512_set1_epi32(1<<(cfg->cordic_bits+cfg->z_extra_bits));
+   const __m512i target      = _mm512_set1_epi32(cfg->target);
+   const __m512i bit0        = _mm512_set1_epi32(1u<<(cfg->cordic_bits+cfg->index_bits));
+   const __m512i bit1        = _mm512_set1_epi32(1u<<(cfg->cordic_bits+cfg->index_bits+1));
+   const __m128i index_shift = _mm_cvtsi32_si128(cfg->cordic_bits);
+   const __m128i z_shift     = _mm_cvtsi32_si128(cfg->z_extra_bits);
+   const __m128i out_shift   = _mm_cvtsi32_si128(cfg->output_extra_bits);
+   size_t j;
+
+   for(j = 0; j+16 <= n; j += 16) {
+     __m512i z, x, y, index, a, b;
+     __mmask16 quadrant_bit0, quadrant_bit1, flip_sin, flip_cos;
+     int i;
+
+     /* Only the low input_bits of each phase matter, so narrow them to 32 bits */
+     z = _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvtepi64_epi32(_mm512_loadu_si512(zp+j))),
+                            _mm512_cvtepi64_epi32(_mm512_loadu_si512(zp+j+8)), 1);
+
+     /* Split into sections, with the quadrant bits as lane masks */
+     quadrant_bit1 = _mm512_test_epi32_mask(z, bit1);
+     quadrant_bit0 = _mm512_test_epi32_mask(z, bit0);
+     index         = _mm512_srl_epi32(_mm512_and_si512(z, index_mask), index_shift);
+     z             = _mm512_sll_epi32(_mm512_and_si512(z, cordic_mask), z_shift);
+
+     flip_sin = quadrant_bit1;
+     flip_cos = quadrant_bit1 ^ quadrant_bit0;
+
+     z = _mm512_mask_sub_epi32(z, quadrant_bit0, z_full, z);
+     z = _mm512_sub_epi32(z, target);
+
+     a = _mm512_i32gather_epi32(index, cfg->initial32, 4);
+     b = _mm512_i32gather_epi32(_mm512_sub_epi32(last_index, index), cfg->initial32, 4);
+     x = _mm512_mask_blend_epi32(quadrant_bit0, b, a);
+     y = _mm512_mask_blend_epi32(quadrant_bit0, a, b);
+
+     for(i = 0; i < cfg->cordic_reps; i++ ) {
+       __m128i   shift = _mm_cvtsi32_si128(cfg->shifts[i]);
+       __m512i   tx    = _mm512_sra_epi32(x, shift);
+       __m512i   ty    = _mm512_sra_epi32(y, shift);
+       __m512i   angle = _mm512_set1_epi32(cfg->angles[i]);
+       __mmask16 neg   = _mm512_cmplt_epi32_mask(z, zero);
+
+       x = _mm512_mask_add_epi32(_mm512_sub_epi32(x, ty),    neg, x, ty);
+       y = _mm512_mask_sub_epi32(_mm512_add_epi32(y, tx),    neg, y, tx);
+       z = _mm512_mask_add_epi32(_mm512_sub_epi32(z, angle), neg, z, angle);
+       z = _mm512_slli_epi32(z, 1);
+     }
+     x = _mm512_sra_epi32(_mm512_mask_sub_epi32(x, flip_cos, zero, x), out_shift);
+     y = _mm512_sra_epi32(_mm512_mask_sub_epi32(y, flip_sin, zero, y), out_shift);
+
+     _mm512_storeu_si512(c+j,   _mm512_cvtepi32_epi64(_mm512_castsi512_si256(x)));
+     _mm512_storeu_si512(c+j+8, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(x, 1)));
+     _mm512_storeu_si512(s+j,   _mm512_cvtepi32_epi64(_mm512_castsi512_si256(y)));
+     _mm512_storeu_si512(s+j+8, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(y, 1)));
+   }
+}
+#endif
+
+/***************************************************************
+ * Calculate Sine and Cosine for an array of 'n' phases. Uses
+ * AVX-512 if the configuration fits in 32-bit lanes, otherwise
+ * AVX2 where the CPU has it, and gives the same results as
+ * cordic_sine_cosine()
+ **************************************************************/
+void cordic_sine_cosine_batch(const struct cordic_config *cfg, const int64_t *z, int64_t *s, int64_t *c, size_t n) {
+   size_t j = 0;
+
+#ifdef HAVE_X86_SIMD
+   /* The hybrid engine and the multiply tail are only done one at a time */
+   if(cfg->hybrid_bits > 0 || cfg->tail_from > 0) {
+   } else if(cfg->narrow && __builtin_cpu_supports("avx512f")) {
+     cordic_sine_cosine_avx512_narrow(cfg, z, s, c, n);
+     j = n & ~(size_t)15;
+   } else if(__builtin_cpu_supports("avx2")) {
+     cordic_sine_cosine_avx2(cfg, z, s, c, n);
+     j = n & ~(size_t)3;
+   }
+#endif
+   for(; j < n; j++)
+     cordic_sine_cosine(cfg, z[j], s+j, c+j);
+}
@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////
+// cordic.h : The enhanced CORDIC SIN()/COS() routines
+//
+// Author: Mike Field <hamster@snap.net.nz>
+//
+// See enhanced_cordic.c for a description of the algorithm and its
+// parameters. Everything about a configuration is held in a
+// 'struct cordic_config', so one program can work with as many
+// configurations as it likes:
+//
+//   struct cordic_config cfg = {0};
+//   cfg.index_bits = 11;  cfg.cordic_bits = 19;  cfg.cordic_reps = 24;
+//   cfg.output_scale = (int64_t)1<<31;
+//   cfg.output_extra_bits = 4;  cfg.z_extra_bits = 2;
+//   if(setup(&cfg) == 0) {
+//     cordic_sine_cosine(&cfg, phase, &s, &c);
+//     ...
+//     cordic_free(&cfg);
+//   }
+//
+// Released under the MIT license - see enhanced_cordic.c
+///////////////////////////////////////////////////////////////////////////
+#ifndef CORDIC_H
+#define CORDIC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+struct cordic_config;
+
+/* The ways the scalar rotation can be done - all give exactly the same results */
+enum {
+   CORDIC_KERNEL_DEFAULT,       /* Selects on the sign of z, as written */
+   CORDIC_KERNEL_BRANCH_FREE,   /* Sign masks, so nothing depends on the phase for branch prediction */
+   CORDIC_KERNELS
+};
+
+extern const char *cordic_kernel_names[CORDIC_KERNELS];
+
+/* How initial[] is held - again, all give exactly the same results */
+enum {
+   CORDIC_STORAGE_WIDE,         /* An int64_t for each entry */
+   CORDIC_STORAGE_PACKED,       /* 40 bits (5 bytes) for each entry, if output_scale<<output_extra_bits allows */
+   CORDIC_STORAGE_PAIRED,       /* Entries i and table_size-1-i side by side, so one 16 byte load gets both */
+   CORDIC_STORAGES
+};
+
+extern const char *cordic_storage_names[CORDIC_STORAGES];
+
+/* Where the tables' memory comes from */
+enum {
+   CORDIC_PAGES_AUTO,           /* Transparent huge pages are asked for, for tables of 2MB or more */
+   CORDIC_PAGES_NORMAL,         /* Only normal pages */
+   CORDIC_PAGES_HUGE,           /* Reserved huge pages (see /proc/sys/vm/nr_hugepages), or setup() fails */
+   CORDIC_PAGE_KINDS
+};
+
+extern const char *cordic_page_names[CORDIC_PAGE_KINDS];
+
+typedef void (*cordic_rotate_fn)(const struct cordic_config *cfg, int64_t z, int64_t *x, int64_t *y);
+
+struct cordic_config {
+   /* Set these before calling setup() */
+   int      index_bits;         /* How many bits are resolved using a lookup table */
+   int      cordic_bits;        /* How many bits are resolved using CORDIC */
+   int      cordic_reps;        /* How many CORDIC iterations are to be performed */
+   int64_t  output_scale;       /* The positive range of the CORDIC output */
+   int      output_extra_bits;  /* Scaling factor for the results in progress */
+   int      z_extra_bits;       /* Scaling factor for the 'z' (angle yet to be resolved) */
+   int      verbose;            /* Print the working, and why a configuration is rejected, from setup().
+                                 * Running out of memory, table file errors and the built-in tables being
+                                 * used instead of table_file are always printed to stderr */
+   int      kernel;             /* CORDIC_KERNEL_DEFAULT or CORDIC_KERNEL_BRANCH_FREE */
+   int      storage;            /* CORDIC_STORAGE_WIDE, _PACKED or _PAIRED */
+   int      generic;            /* Use the rotation that loads angles[] and shifts[], even if there is a specialized one */
+   int      pages;              /* CORDIC_PAGES_AUTO, _NORMAL or _HUGE */
+   const char *table_file;      /* If set, map the tables read-only from this file, making it if it doesn't exist */
+   int      threads;            /* Threads to work out big tables with, or 0 for one per CPU */
+   int      hybrid_bits;        /* If above 0, the top hybrid_bits of the CORDIC bits are resolved with one
+                                 * multiply-add from deriv[], and CORDIC skips that many iterations */
+   int      tail_from;          /* If above 0, the iterations from this one on are replaced by one multiply,
+                                 * taking sin(z) = z and cos(z) = 1 for what is left in z */
+
+   /* Filled in by setup() */
+   int      input_bits;         /* 2+index_bits+cordic_bits */
+   int64_t  full_circle;
+   int64_t  table_size;
+   int64_t  cordic_mask;
+   int64_t  index_mask;
+   int64_t  target;
+   int      narrow;             /* x, y and z all fit in 32 bits */
+   const int32_t *angles;
+   const int32_t *shifts;
+   const int64_t *initial;      /* Only if storage is CORDIC_STORAGE_WIDE */
+   const uint8_t *packed;       /* initial[] in 5 bytes an entry, if storage is CORDIC_STORAGE_PACKED */
+   const int64_t *paired;       /* initial[i] then initial[table_size-1-i] for the first half of the
+                                 * table, 16 byte aligned, if storage is CORDIC_STORAGE_PAIRED */
+   int64_t  table_bytes;        /* The size of initial[], packed[] or paired[] */
+   double   table_seconds;      /* How long working out initial[] took - 0 if it wasn't */
+   const int64_t *deriv;        /* For the hybrid engine, initial[] times half a sub-block's angle */
+   int      hybrid_shift;       /* The fraction bits in deriv[] */
+   int64_t  tail_scale;         /* For the multiply tail, z*tail_scale>>tail_scale_shift is in radians */
+   int      tail_scale_shift;
+   int      tail_shift;         /* ...with tail_shift fraction bits */
+   const int32_t *initial32;    /* Copy of initial[] for the narrow kernel, if 'narrow' */
+   int      built_in;           /* The tables are the constant ones from cordic_tables.h, not allocated */
+   void    *mapped;             /* The table file, if the tables are in one */
+   size_t   mapped_bytes;
+   cordic_rotate_fn rotate;     /* The rotation, specialized for this configuration if possible */
+};
+
+/***************************************************************
+ * A record of the working for one step of the CORDIC rotation.
+ * A trace has cordic_reps+1 records - the starting values then
+ * the values after each iteration.
+ **************************************************************/
+struct cordic_trace_record {
+   int64_t x, y, z;
+};
+
+/* Entry 'i' of packed[], read as 8 bytes and sign extended from 40 bits */
+static inline int64_t cordic_unpack(const uint8_t *packed, int64_t i) {
+   uint64_t v;
+
+   memcpy(&v, packed + 5*i, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   v = __builtin_bswap64(v);
+#endif
+   return (int64_t)(v << 24) >> 24;
+}
+
+/* Entry 'i' of initial[], however it is held */
+static inline int64_t cordic_table_entry(const struct cordic_config *cfg, int64_t i) {
+   int64_t half = cfg->table_size/2;
+
+   switch(cfg->storage) {
+     case CORDIC_STORAGE_PACKED: return cordic_unpack(cfg->packed, i);
+     case CORDIC_STORAGE_PAIRED: return i < half ? cfg->paired[2*i] : cfg->paired[2*(cfg->table_size-1-i)+1];
+     default:                    return cfg->initial[i];
+   }
+}
+
+/* Returns 0 on success, or -1 if the configuration can't be used */
+int  setup(struct cordic_config *cfg);
+void cordic_free(struct cordic_config *cfg);
+
+void cordic_sine_cosine(const struct cordic_config *cfg, int64_t z, int64_t *s, int64_t *c);
+void cordic_sine_cosine_trace(const struct cordic_config *cfg, int64_t z, int64_t *s, int64_t *c,
+                              struct cordic_trace_record *trace);
+void cordic_sine_cosine_batch(const struct cordic_config *cfg, const int64_t *z, int64_t *s, int64_t *c, size_t n);
+void print_trace(const struct cordic_config *cfg, const struct cordic_trace_record *trace);
+
+/* The raw rotation, before the quadrant's signs are applied and the extra bits removed */
+static inline void cordic_rotate(const struct cordic_config *cfg, int64_t z, int64_t *x, int64_t *y) {
+   cfg->rotate(cfg, z, x, y);
+}
+
+#endif
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////
+// counters.c : Hardware performance counters, for the test programs
+//
+// Author: Mike Field <hamster@snap.net.nz>
+//
+// See counters.h for how to use these.
+//
+// Released under the MIT license - see enhanced_cordic.c
+///////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "counters.h"
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+const char *perf_names[PERF_COUNTERS] = {"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"};
+
+static const char *open_error = "not supported on this system";
+
+#if defined(__linux__)
+static const struct {
+   uint32_t type;
+   uint64_t config;
+} events[PERF_COUNTERS] = {
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+   {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+   {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+   {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL  | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+#endif
+
+int perf_open(struct perf_counters *pc) {
+   int i, opened = 0;
+
+   for(i = 0; i < PERF_COUNTERS; i++) {
+      pc->fd[i] = -1;
+#if defined(__linux__)
+      {
+         struct perf_event_attr attr;
+
+         memset(&attr, 0, sizeof(attr));
+         attr.size           = sizeof(attr);
+         attr.type           = events[i].type;
+         attr.config         = events[i].config;
+         attr.exclude_kernel = 1;
+         attr.exclude_hv     = 1;
+         attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+         /* This thread only, on whatever CPU it runs on */
+         pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+         if(pc->fd[i] < 0)
+            open_error = strerror(errno);
+         else
+            opened++;
+      }
+#endif
+   }
+   return opened;
+}
+
+const char *perf_error(void) {
+   return open_error;
+}
+
+void perf_read(const struct perf_counters *pc, struct perf_reading *r) {
+   int i;
+
+   for(i = 0; i < PERF_COUNTERS; i++) {
+      uint64_t v[3];
+
+      r->valid[i] = pc->fd[i] >= 0 && read(pc->fd[i], v, sizeof(v)) == sizeof(v);
+      r->value[i]   = r->valid[i] ? v[0] : 0;
+      r->enabled[i] = r->valid[i] ? v[1] : 0;
+      r->running[i] = r->valid[i] ? v[2] : 0;
+   }
+}
+
+void perf_close(struct perf_counters *pc) {
+   int i;
+
+   for(i = 0; i < PERF_COUNTERS; i++) {
+      if(pc->fd[i] >= 0)
+         close(pc->fd[i]);
+      pc->fd[i] = -1;
+   }
+}
+
+void perf_add(struct perf_totals *t, const struct perf_reading *before, const struct perf_reading *after) {
+   int i;
+
+   for(i = 0; i < PERF_COUNTERS; i++) {
+      if(!before->valid[i] || !after->valid[i])
+         continue;
+      t->available[i] = 1;
+      t->value[i]    += after->value[i]   - before->value[i];
+      t->enabled[i]  += after->enabled[i] - before->enabled[i];
+      t->running[i]  += after->running[i] - before->running[i];
+   }
+}
+
+void perf_merge(struct perf_totals *to, const struct perf_totals *from) {
+   int i;
+
+   for(i = 0; i < PERF_COUNTERS; i++) {
+      to->available[i] |= from->available[i];
+      to->value[i]      += from->value[i];
+      to->enabled[i]    += from->enabled[i];
+      to->running[i]    += from->running[i];
+   }
+}
+
+double perf_value(const struct perf_totals *t, int i) {
+   if(!t->available[i])
+      return -1.0;
+   if(t->running[i] == 0)
+      return t->enabled[i] ? -1.0 : 0.0;      /* Never got onto the hardware */
+   return (double)t->value[i] * t->enabled[i] / t->running[i];
+}
+
+void perf_print_header(FILE *f, const char *title) {
+   int i;
+
+   fprintf(f, "%-14s", title);
+   for(i = 0; i < PERF_COUNTERS; i++)
+      fprintf(f, " %14s", perf_names[i]);
+   fprintf(f, " %6s\n", "IPC");
+}
+
+void perf_print(FILE *f, const char *name, const struct perf_totals *t, double per) {
+   int i;
+
+   fprintf(f, "%-14s", name);
+   for(i = 0; i < PERF_COUNTERS; i++) {
+      double v = perf_value(t, i);
+      if(v < 0)
+         fprintf(f, " %14s", "n/a");
+      else
+         fprintf(f, " %14.*f", per == 1.0 ? 0 : 3, v / per);
+   }
+   if(perf_value(t, PERF_CYCLES) > 0 && perf_value(t, PERF_INSTRUCTIONS) >= 0)
+      fprintf(f, " %6.2f", perf_value(t, PERF_INSTRUCTIONS) / perf_value(t, PERF_CYCLES));
+   fprintf(f, "\n");
+}
+
+void perf_json(FILE *f, const struct perf_totals *t, double per) {
+   int i;
+
+   fprintf(f, "{");
+   for(i = 0; i < PERF_COUNTERS; i++) {
+      double v = perf_value(t, i);
+      if(v < 0)
+         fprintf(f, "%s\"%s\": null", i ? ", " : "", perf_names[i]);
+      else
+         fprintf(f, "%s\"%s\": %.4f", i ? ", " : "", perf_names[i], v / per);
+   }
+   fprintf(f, "}");
+}
@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////
+// counters.h : Hardware performance counters, for the test programs
+//
+// Author: Mike Field <hamster@snap.net.nz>
+//
+// A thin wrapper around Linux's perf_event_open(), counting for the
+// calling thread only. Counters that the CPU, kernel or permissions
+// don't allow are left out, and on other systems none are available,
+// so callers should carry on without them.
+//
+//   struct perf_counters pc;
+//   struct perf_reading  before, after;
+//   struct perf_totals   totals = {0};
+//
+//   if(perf_open(&pc) > 0) {
+//     perf_read(&pc, &before);
+//     ... the work to count ...
+//     perf_read(&pc, &after);
+//     perf_add(&totals, &before, &after);
+//     perf_close(&pc);
+//   }
+//
+// Released under the MIT license - see enhanced_cordic.c
+///////////////////////////////////////////////////////////////////////////
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_COUNTERS };
+
+extern const char *perf_names[PERF_COUNTERS];
+
+struct perf_counters {
+   int fd[PERF_COUNTERS];      /* -1 if the counter isn't available */
+};
+
+/* The raw values, and the time each counter was enabled and actually running */
+struct perf_reading {
+   int      valid[PERF_COUNTERS];
+   uint64_t value[PERF_COUNTERS], enabled[PERF_COUNTERS], running[PERF_COUNTERS];
+};
+
+/* Counts added up over a number of intervals */
+struct perf_totals {
+   int      available[PERF_COUNTERS];
+   uint64_t value[PERF_COUNTERS], enabled[PERF_COUNTERS], running[PERF_COUNTERS];
+};
+
+/* Returns how many counters could be opened - if none, perf_error() says why */
+int    perf_open(struct perf_counters *pc);
+const char *perf_error(void);
+void   perf_read(const struct perf_counters *pc, struct perf_reading *r);
+void   perf_close(struct perf_counters *pc);
+
+void   perf_add(struct perf_totals *t, const struct perf_reading *before, const struct perf_reading *after);
+void   perf_merge(struct perf_totals *to, const struct perf_totals *from);
+/* The count, scaled up if the counter had to share the hardware, or -1 if not available */
+double perf_value(const struct perf_totals *t, int i);
+
+/* Print a heading, a line of counts divided by 'per', or a JSON object of them */
+void   perf_print_header(FILE *f, const char *title);
+void   perf_print(FILE *f, const char *name, const struct perf_totals *t, double per);
+void   perf_json(FILE *f, const struct perf_totals *t, double per);
+
+#endif
@@ -30,6 +30,11 @@
 // MAX_ERROR         The limit where the working will be printed out, for
 //                   debugging
 //
+// The routines themselves are in cordic.c, and take these parameters
+// in a 'struct cordic_config' so they can be changed at run time. The
+// values below are the defaults for this test program, and can be
+// changed with its -I, -C, -R, -O, -E and -Z options.
+//
 // The benefits of this optimizations are lower latency, lower resource 
 // usage, and maybe allow higher Fmax performance 
 // 
@@ -62,177 +67,1804 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "cordic.h"
+#include "counters.h"
+#include "util.h"
+
+/* These can all be overridden on the compiler's command line */
 
 /* How the parameter is made broken up */
+#ifndef INDEX_BITS
 #define INDEX_BITS     (11)
+#endif
+#ifndef CORDIC_BITS
 #define CORDIC_BITS    (19)
-#define INPUT_BITS     (2+INDEX_BITS+CORDIC_BITS)
+#endif
 
 /* Details for the output */
+#ifndef CORDIC_REPS
 #define CORDIC_REPS       (24)
+#endif
+#ifndef OUTPUT_SCALE
 #define OUTPUT_SCALE      ((int64_t)1<<31)
+#endif
 
 /* Scaling factor or the results in progress */
+#ifndef OUTPUT_EXTRA_BITS
 #define OUTPUT_EXTRA_BITS (4)
+#endif
 
 /* Scaling vactor for the z */
+#ifndef Z_EXTRA_BITS
 #define Z_EXTRA_BITS   (2)
+#endif
 
 /* Limit where we print out errors */
+#ifndef MAX_ERROR
 #define MAX_ERROR  (3.0)
+#endif
+
+/***************************************************************
+ * Accumulated results for one section of the test sweep
+ **************************************************************/
+#define HIST_LIMIT (15)
+#define HIST_BINS  (2*HIST_LIMIT+1)
+
+/* The signed errors for one output in one quadrant */
+struct error_stats {
+  double  sum, abs_sum, max;
+  int64_t hist[HIST_BINS];   /* Count of errors from -HIST_LIMIT (and under) to HIST_LIMIT (and over) */
+};
+
+/* The errors for one table index */
+struct index_stats {
+  double  sum, max;
+  int64_t count;
+};
+
+struct sweep_stats {
+  double  total_e;
+  double  max;
+  int64_t count;
+  int64_t out_of_range;
+  struct error_stats quadrant[4][2];  /* SIN [0] and COS [1] errors in each quadrant */
+  int64_t *bad;            /* Phases that were out of range, in order */
+  int64_t bad_size;
+  int     count_only;      /* Only count the out of range phases, don't remember them */
+  struct index_stats *index;  /* If not NULL, the errors for each of the index_size table indexes */
+  int64_t index_size;
+};
+
+/***************************************************************
+ * Reference values
+ *
+ * Rather than calling sin() and cos() for every phase, the phase
+ * within the quadrant is split into a block and an offset, and the
+ * result is built with the angle addition formulas:
+ *
+ *   sin(b+o) = sin(b) + sin(b)(cos(o)-1) + cos(b)sin(o)
+ *   cos(b+o) = cos(b) + cos(b)(cos(o)-1) - sin(b)sin(o)
+ *
+ * The tables are calculated with long doubles. sin(b) and cos(b) are
+ * kept in double-double (the unevaluated sum of two doubles), and as
+ * the offset is small the correction terms only need plain doubles,
+ * so the reference is good to about 2^-60 of full scale - far below
+ * one output LSB. The quadrant only swaps and negates the results.
+ *
+ * The split is half-and-half rather than on the INDEX_BITS and
+ * CORDIC_BITS boundary, so that neither table gets large.
+ **************************************************************/
+typedef struct { double hi, lo; } dd_t;
+
+struct ref_block_entry {
+  dd_t sin, cos;           /* Multiplied by OUTPUT_SCALE */
+};
+
+struct ref_offset_entry {
+  double sin, cos_m1;      /* sin(o) and cos(o)-1 */
+};
+
+struct reference {
+  int     offset_bits, block_bits;
+  int64_t offset_mask;
+  struct ref_block_entry  *block;
+  struct ref_offset_entry *offset;
+};
+
+int use_libm = 0;     /* Use the C library's sin() and cos() instead */
+int use_perf = 0;     /* Read the hardware counters for each part of the sweep */
+
+/* A configuration under test, with its reference tables */
+struct test {
+  struct cordic_config cfg;
+  struct reference     ref;
+};
+
+struct sweep_worker {
+  pthread_t          thread;
+  const struct test *t;
+  int64_t            start, end;
+  struct sweep_stats stats;
+  int64_t            mismatches;      /* For the batch kernel check */
+  double             scalar_time, batch_time;
+  struct stratum    *strata;          /* For sampling */
+  int64_t            samples;         /* ...and how many to take from each block */
+  struct perf_totals kernel, reference; /* Hardware counters, with -p */
+};
+
+static inline dd_t dd_from_long_double(long double v) {
+  dd_t r;
+  r.hi = (double)v;
+  r.lo = (double)(v - r.hi);
+  return r;
+}
+
+static inline dd_t two_sum(double a, double b) {
+  dd_t r;
+  double bb;
+  r.hi = a + b;
+  bb   = r.hi - a;
+  r.lo = (a - (r.hi - bb)) + (b - bb);
+  return r;
+}
+
+static inline dd_t quick_two_sum(double a, double b) {
+  dd_t r;
+  r.hi = a + b;
+  r.lo = b - (r.hi - a);
+  return r;
+}
+
+/* Add a (small) double to a double-double */
+static inline dd_t dd_add_d(dd_t a, double b) {
+  dd_t s = two_sum(a.hi, b);
+  return quick_two_sum(s.hi, s.lo + a.lo);
+}
+
+static inline dd_t dd_neg(dd_t a) {
+  a.hi = -a.hi;
+  a.lo = -a.lo;
+  return a;
+}
+
+int setup_reference(const struct cordic_config *cfg, struct reference *ref) {
+  const long double full_circle = 2*3.14159265358979323846264338327950288L;
+  int64_t i;
+
+  ref->offset_bits = (cfg->index_bits+cfg->cordic_bits)/2;
+  ref->block_bits  = cfg->index_bits+cfg->cordic_bits-ref->offset_bits;
+  ref->offset_mask = ((int64_t)1<<ref->offset_bits)-1;
+  ref->block  = malloc(sizeof(struct ref_block_entry)  << ref->block_bits);
+  ref->offset = malloc(sizeof(struct ref_offset_entry) << ref->offset_bits);
+  if(ref->block == NULL || ref->offset == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  for(i = 0; i < ((int64_t)1<<ref->block_bits); i++) {
+    long double angle = full_circle * (i << ref->offset_bits) / cfg->full_circle;
+    ref->block[i].sin = dd_from_long_double(sinl(angle) * cfg->output_scale);
+    ref->block[i].cos = dd_from_long_double(cosl(angle) * cfg->output_scale);
+  }
+  for(i = 0; i < ((int64_t)1<<ref->offset_bits); i++) {
+    long double angle = full_circle * i / cfg->full_circle;
+    ref->offset[i].sin    = sinl(angle);
+    ref->offset[i].cos_m1 = -2*sinl(angle/2)*sinl(angle/2);
+  }
+  return 0;
+}
+
+/***************************************************************
+ * Set up a configuration for testing, and free it afterwards
+ **************************************************************/
+static int test_setup(struct test *t) {
+  memset(&t->ref, 0, sizeof(t->ref));
+  if(setup(&t->cfg) != 0)
+    return -1;
+  if(setup_reference(&t->cfg, &t->ref) != 0) {
+    cordic_free(&t->cfg);
+    return -1;
+  }
+  return 0;
+}
+
+static void test_free(struct test *t) {
+  cordic_free(&t->cfg);
+  free(t->ref.block);
+  free(t->ref.offset);
+}
+
+/***************************************************************
+ * The sin() and cos() of a phase, multiplied by OUTPUT_SCALE
+ **************************************************************/
+static void reference(const struct test *t, int64_t a, dd_t *vs, dd_t *vc) {
+  const struct cordic_config *cfg = &t->cfg;
+  const struct ref_block_entry *b;
+  const struct ref_offset_entry *o;
+  int64_t r = a & (cfg->full_circle/4-1);
+  dd_t rs, rc;
+
+  if(use_libm) {
+    vs->hi = sin(a*(2*PI/cfg->full_circle))*(cfg->output_scale);
+    vc->hi = cos(a*(2*PI/cfg->full_circle))*(cfg->output_scale);
+    vs->lo = vc->lo = 0.0;
+    return;
+  }
+
+  b  = &t->ref.block[r >> t->ref.offset_bits];
+  o  = &t->ref.offset[r & t->ref.offset_mask];
+  rs = dd_add_d(b->sin, b->sin.hi*o->cos_m1 + b->cos.hi*o->sin);
+  rc = dd_add_d(b->cos, b->cos.hi*o->cos_m1 - b->sin.hi*o->sin);
+
+  switch((a >> (cfg->index_bits+cfg->cordic_bits)) & 3) {
+    case 0: *vs = rs;         *vc = rc;         break;
+    case 1: *vs = rc;         *vc = dd_neg(rs); break;
+    case 2: *vs = dd_neg(rs); *vc = dd_neg(rc); break;
+    case 3: *vs = dd_neg(rc); *vc = rs;         break;
+  }
+}
+
+/***************************************************************
+ * The expected output for a reference value: (int64_t)(v-0.5),
+ * but taking the low part of 'v' into account
+ **************************************************************/
+static int64_t expected(dd_t v) {
+  dd_t t = two_sum(v.hi, -0.5);
+  double n;
+
+  t = quick_two_sum(t.hi, t.lo + v.lo);
+  n = trunc(t.hi);
+  if(n == t.hi) {
+    if(n > 0 && t.lo < 0) n -= 1;
+    if(n < 0 && t.lo > 0) n += 1;
+  }
+  return (int64_t)n;
+}
+
+/***************************************************************
+ * Calculate the CORDIC result for a phase, and the error when
+ * compared to the reference
+ **************************************************************/
+static void phase_error(const struct test *t, int64_t a, int64_t *s, int64_t *c, double *es, double *ec) {
+  dd_t vs, vc;
+
+  cordic_sine_cosine(&t->cfg, a, s, c);
+  reference(t, a, &vs, &vc);
+  *es = *s-expected(vs);
+  *ec = *c-expected(vc);
+}
+
+/***************************************************************
+ * Add the error for one phase to the running totals
+ **************************************************************/
+static void add_bad(struct sweep_stats *st, int64_t a) {
+  if(st->count_only) {
+    st->out_of_range++;
+    return;
+  }
+  if(st->out_of_range == st->bad_size) {
+    st->bad_size = st->bad_size ? st->bad_size*2 : 64;
+    st->bad = realloc(st->bad, st->bad_size * sizeof(int64_t));
+    if(st->bad == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+  st->bad[st->out_of_range++] = a;
+}
+
+static void add_output_error(struct error_stats *e, double err) {
+  e->sum     += err;
+  e->abs_sum += fabs(err);
+  if(e->max < fabs(err)) e->max = fabs(err);
+  e->hist[err <= -HIST_LIMIT ? 0 : err >= HIST_LIMIT ? HIST_BINS-1 : (int)err + HIST_LIMIT]++;
+}
+
+static void add_error(const struct test *t, struct sweep_stats *st, int64_t a, double es, double ec) {
+  int q = (a >> (t->cfg.index_bits+t->cfg.cordic_bits)) & 3;
+
+  /* Remember bad phases, so the working can be printed in order later */
+  if(es >= MAX_ERROR || es <= -MAX_ERROR || ec >= MAX_ERROR || ec <= -MAX_ERROR)
+    add_bad(st, a);
+
+  if(es > 0) st->total_e += es;
+  else       st->total_e -= es;
+
+  if(ec > 0) st->total_e += ec;
+  else       st->total_e -= ec;
+
+  if(st->max < es)  st->max =  es;
+  if(st->max < -es) st->max = -es;
+  if(st->max < ec)  st->max =  ec;
+  if(st->max < -ec) st->max = -ec;
+  add_output_error(&st->quadrant[q][0], es);
+  add_output_error(&st->quadrant[q][1], ec);
+  if(st->index) {
+    struct index_stats *e = &st->index[(a & t->cfg.index_mask) >> t->cfg.cordic_bits];
+
+    e->sum += fabs(es) + fabs(ec);
+    if(e->max < fabs(es)) e->max = fabs(es);
+    if(e->max < fabs(ec)) e->max = fabs(ec);
+    e->count++;
+  }
+  st->count++;
+}
+
+/***************************************************************
+ * Test all phases from 'start' up to (but not including) 'end'.
+ *
+ * This is done a block at a time - first the CORDIC results for
+ * the block, then the reference and statistics - so that with -p
+ * the hardware counters can be read for each of them separately.
+ **************************************************************/
+#define SWEEP_BLOCK (4096)
+
+static void *sweep(void *arg) {
+  struct sweep_worker *w = arg;
+  const struct test *t = w->t;
+  int64_t s[SWEEP_BLOCK], c[SWEEP_BLOCK];
+  struct perf_counters pc;
+  struct perf_reading r0, r1, r2;
+  int counting = use_perf && perf_open(&pc) > 0;
+  int64_t a, j;
+
+  if(counting)
+    perf_read(&pc, &r0);
+  for(a = w->start; a < w->end; a += SWEEP_BLOCK) {
+    int64_t n = w->end - a < SWEEP_BLOCK ? w->end - a : SWEEP_BLOCK;
+
+    for(j = 0; j < n; j++)
+      cordic_sine_cosine(&t->cfg, a+j, s+j, c+j);
+    if(counting)
+      perf_read(&pc, &r1);
+
+    for(j = 0; j < n; j++) {
+      dd_t vs, vc;
+
+      reference(t, a+j, &vs, &vc);
+      add_error(t, &w->stats, a+j, s[j]-expected(vs), c[j]-expected(vc));
+    }
+    if(counting) {
+      perf_read(&pc, &r2);
+      perf_add(&w->kernel,    &r0, &r1);
+      perf_add(&w->reference, &r1, &r2);
+      r0 = r2;
+    }
+  }
+  if(counting)
+    perf_close(&pc);
+  return NULL;
+}
+
+/***************************************************************
+ * Quadrant symmetry
+ *
+ * For a first quadrant phase 'r' with raw CORDIC results x and y
+ * (before signs and scaling), the other quadrants are related by:
+ *
+ *   Phase        Raw values from   SIN      COS
+ *   r            r                 y        x
+ *   2*Q + r      r                 -y       -x
+ *   2*Q - r      r                 y        -x    (only if the CORDIC bits of r are not 0)
+ *   4*Q - r      r                 -y       x     (only if the CORDIC bits of r are not 0)
+ *
+ * The 2*Q-r and 4*Q-r cases are the 'quadrant_bit0' mirror of z and
+ * the table index. When the CORDIC bits of r are zero the mirror
+ * would need a CORDIC field of 2^CORDIC_BITS, so those phases
+ * (Q + r and 3*Q + r) have to be tested directly.
+ **************************************************************/
+static void mirror_result(const struct test *t, int64_t x, int64_t y, int neg_sin, int neg_cos,
+                          int64_t *s, int64_t *c) {
+  *s = (neg_sin ? -y : y)>>t->cfg.output_extra_bits;
+  *c = (neg_cos ? -x : x)>>t->cfg.output_extra_bits;
+}
+
+static void mirror_error(const struct test *t, struct sweep_stats *st, int64_t a, int64_t x, int64_t y,
+                         dd_t vs, dd_t vc, int neg_sin, int neg_cos) {
+  int64_t s, c;
+  double es,ec;
+
+  mirror_result(t, x, y, neg_sin, neg_cos, &s, &c);
+  es = s-expected(neg_sin ? dd_neg(vs) : vs);
+  ec = c-expected(neg_cos ? dd_neg(vc) : vc);
+  add_error(t, st, a, es, ec);
+}
 
-#define PI                (3.14159265358979323846)
-#define FULL_CIRCLE       ((int64_t)1<<INPUT_BITS)
-
-
-/* Masks for extracting parts */
-#define QUADRANT_MASK (3 <<(INDEX_BITS+CORDIC_BITS))
-#define CORDIC_MASK  ((1<<CORDIC_BITS)-1)
-#define INDEX_MASK   (((1<<INDEX_BITS)-1) << CORDIC_BITS)
-#define TABLE_SIZE   (1<<INDEX_BITS)
-#define TARGET       (1<<(CORDIC_BITS+Z_EXTRA_BITS-1))
-
-
-int32_t angles[CORDIC_REPS];
-int32_t shifts[CORDIC_REPS];
-int64_t initial[TABLE_SIZE];
-/****************************************************************
- * Calculate the values required for CORDIC sin()/cos() function
- ***************************************************************/
-void setup(void) {
-   int i, start_shifts;
-   double scale = pow(0.5,0.5);
-   double table_angle, half_table_angle;
-   double cordic_start;
-   double table_magnitude;
-
-   table_angle      = PI / 2.0 / TABLE_SIZE;
-   half_table_angle = table_angle / 2.0;
-
-   cordic_start     = log(atan(half_table_angle))/log(2.0);
-   start_shifts     = ceil(cordic_start);
-   printf("Starting CORDIC at lest %13.11f => %i shifts\n", cordic_start, start_shifts);
-
-   scale = 1.0;
-   for(i = 0; i < CORDIC_REPS; i++ ) {
-     double angle = atan(1.0/pow(2,i-start_shifts));
-     angles[i]  = FULL_CIRCLE * angle / (2*PI) * ((int64_t)1<<(Z_EXTRA_BITS+i))+1;
-     shifts[i]  = INDEX_BITS+i;
-     scale     *= cos(angle);
-     printf("angle[%i] = %i\n",i, angles[i]);
-   }
-   table_magnitude = (OUTPUT_SCALE * scale)*pow(2,OUTPUT_EXTRA_BITS);
-
-   for(i = 0; i < TABLE_SIZE; i++) {
-     initial[i] = (int64_t)(table_magnitude * sin(table_angle * i + half_table_angle)-pow(2,OUTPUT_EXTRA_BITS-1));
-   }
-   if(angles[0] == angles[CORDIC_REPS-1]) {
-      printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-      printf("!! NOTE = All entries in 'angles' are the same, so a constant can be used     !!!\n");
-      printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n\n");
-   }
-}
-
-/***************************************************************
- * Cordic routine to calculate Sine and Cosine for angles
- * with 2^INPUT_BITS representing the full circle
- **************************************************************/
-void cordic_sine_cosine(int64_t z, int64_t *s, int64_t *c, int show) {
-   int8_t i, flip_sin_sign, flip_cos_sign, quadrant_bit0, quadrant_bit1;
-   int32_t index;
-   int64_t x, y; 
-
-   /* Split into sections */
-   quadrant_bit1 = (z >> (CORDIC_BITS+INDEX_BITS+1)) & 1;
-   quadrant_bit0 = (z >> (CORDIC_BITS+INDEX_BITS  )) & 1;
-   index         = (z &  INDEX_MASK) >> CORDIC_BITS;
-   z             = (z & CORDIC_MASK) << Z_EXTRA_BITS;
-
-   /* Sort out hot to respond to the quadrant we are in */
-   flip_sin_sign = quadrant_bit1;
-   flip_cos_sign = quadrant_bit1 ^ quadrant_bit0;
-
-   if(quadrant_bit0) 
-      z = (1<<(CORDIC_BITS+Z_EXTRA_BITS)) -z; 
-
-   z -= TARGET;
-
-   /* Subtract half the sector angle from Z */
-   /* Use Dual Port memory for this */
-   if(quadrant_bit0) {
-     x = initial[index];
-     y = initial[TABLE_SIZE-1-index];
-   } else {
-     x = initial[TABLE_SIZE-1-index];
-     y = initial[index];
-   }
-
-   if(show) {
-     printf("      SIN        COS        Z\n");
-     printf("%10li, %10li, %10li\n", y, x, z);
-   }
-
-   for(i = 0; i < CORDIC_REPS; i++ ) {
-     int64_t tx = x >> shifts[i];
-     int64_t ty = y >> shifts[i];
-
-     x -= (z < 0) ?       -ty :        ty;
-     y += (z < 0) ?       -tx :        tx;
-     z += (z < 0) ? angles[i] : -angles[i];
-     z <<= 1;
-
-     if(show) {
-       printf("%10li, %10li, %10li\n", y, x, z);
-     }
-   }
-   *c = (flip_cos_sign  ? -x : x)>>OUTPUT_EXTRA_BITS;
-   *s = (flip_sin_sign ? -y : y)>>OUTPUT_EXTRA_BITS;
+/***************************************************************
+ * Prove that the symmetry relations above hold bit-exactly for
+ * the first, second and last phase of every table block, in all
+ * quadrants. Returns the number of phases where they don't.
+ **************************************************************/
+static int64_t check_symmetry(const struct test *t) {
+  const struct cordic_config *cfg = &t->cfg;
+  const int64_t quadrant_size = cfg->full_circle/4;
+  int64_t offsets[3];
+  int64_t failed = 0, tested = 0;
+  int64_t i;
+  int j, k;
+
+  offsets[0] = 0;
+  offsets[1] = 1;
+  offsets[2] = cfg->cordic_mask;
+  for(i = 0; i < cfg->table_size; i++) {
+    for(j = 0; j < 3; j++) {
+      int64_t r = (i << cfg->cordic_bits) | offsets[j];
+      int64_t phases[4];
+      int64_t x, y;
+
+      phases[0] = r;
+      phases[1] = 2*quadrant_size + r;
+      phases[2] = 2*quadrant_size - r;
+      phases[3] = 4*quadrant_size - r;
+
+      cordic_rotate(cfg, r, &x, &y);
+      for(k = 0; k < 4; k++) {
+        int64_t s, c, ms, mc;
+
+        if(k >= 2 && (r & cfg->cordic_mask) == 0)
+          continue;
+        cordic_sine_cosine(cfg, phases[k], &s, &c);
+        mirror_result(t, x, y, k == 1 || k == 3, k == 1 || k == 2, &ms, &mc);
+        if(s != ms || c != mc) {
+          printf("Symmetry fails at phase %li: %li, %li expected %li, %li\n", phases[k], s, c, ms, mc);
+          failed++;
+        }
+        tested++;
+      }
+    }
+  }
+  if(failed == 0)
+    printf("Quadrant symmetry holds at all %li block boundary phases\n", tested);
+  return failed;
+}
+
+/***************************************************************
+ * Test all first quadrant phases from 'start' up to (but not
+ * including) 'end', and the phases in the other quadrants that
+ * mirror them
+ **************************************************************/
+static void *sweep_symmetric(void *arg) {
+  struct sweep_worker *w = arg;
+  struct sweep_stats *st = &w->stats;
+  const struct test *t = w->t;
+  const int64_t quadrant_size = t->cfg.full_circle/4;
+  int64_t x[SWEEP_BLOCK], y[SWEEP_BLOCK];
+  struct perf_counters pc;
+  struct perf_reading r0, r1, r2;
+  int counting = use_perf && perf_open(&pc) > 0;
+  int64_t b, j;
+
+  if(counting)
+    perf_read(&pc, &r0);
+  for(b = w->start; b < w->end; b += SWEEP_BLOCK) {
+    int64_t n = w->end - b < SWEEP_BLOCK ? w->end - b : SWEEP_BLOCK;
+
+    for(j = 0; j < n; j++)
+      cordic_rotate(&t->cfg, b+j, x+j, y+j);
+    if(counting)
+      perf_read(&pc, &r1);
+
+    for(j = 0; j < n; j++) {
+      int64_t r = b+j;
+      dd_t vs, vc;
+
+      reference(t, r, &vs, &vc);
+
+      mirror_error(t, st, r,                   x[j], y[j], vs, vc, 0, 0);
+      mirror_error(t, st, 2*quadrant_size + r, x[j], y[j], vs, vc, 1, 1);
+
+      if(r & t->cfg.cordic_mask) {
+        mirror_error(t, st, 2*quadrant_size - r, x[j], y[j], vs, vc, 0, 1);
+        mirror_error(t, st, 4*quadrant_size - r, x[j], y[j], vs, vc, 1, 0);
+      } else {
+        int64_t s, c;
+        double es,ec;
+
+        phase_error(t, quadrant_size + r, &s, &c, &es, &ec);
+        add_error(t, st, quadrant_size + r, es, ec);
+        phase_error(t, 3*quadrant_size + r, &s, &c, &es, &ec);
+        add_error(t, st, 3*quadrant_size + r, es, ec);
+      }
+    }
+    if(counting) {
+      perf_read(&pc, &r2);
+      perf_add(&w->kernel,    &r0, &r1);
+      perf_add(&w->reference, &r1, &r2);
+      r0 = r2;
+    }
+  }
+  if(counting)
+    perf_close(&pc);
+  return NULL;
+}
+
+/***************************************************************
+ * Check that cordic_sine_cosine_batch() gives the same results
+ * as cordic_sine_cosine() for all phases in the worker's range,
+ * and time the two of them
+ **************************************************************/
+#define CHECK_BLOCK (4096)
+
+static void *check_batch(void *arg) {
+  struct sweep_worker *w = arg;
+  const struct cordic_config *cfg = &w->t->cfg;
+  int64_t phase[CHECK_BLOCK], s[CHECK_BLOCK], c[CHECK_BLOCK], bs[CHECK_BLOCK], bc[CHECK_BLOCK];
+  int64_t a;
+
+  for(a = w->start; a < w->end; a += CHECK_BLOCK) {
+    int64_t n = w->end - a < CHECK_BLOCK ? w->end - a : CHECK_BLOCK;
+    int64_t j;
+    double t0, t1, t2;
+
+    for(j = 0; j < n; j++)
+      phase[j] = a+j;
+
+    t0 = seconds();
+    for(j = 0; j < n; j++)
+      cordic_sine_cosine(cfg, phase[j], s+j, c+j);
+    t1 = seconds();
+    cordic_sine_cosine_batch(cfg, phase, bs, bc, n);
+    t2 = seconds();
+    w->scalar_time += t1-t0;
+    w->batch_time  += t2-t1;
+
+    for(j = 0; j < n; j++) {
+      if(s[j] != bs[j] || c[j] != bc[j]) {
+        if(w->mismatches < 10)
+          printf("Batch mismatch at phase %li: %li, %li expected %li, %li\n", phase[j], bs[j], bc[j], s[j], c[j]);
+        w->mismatches++;
+      }
+    }
+  }
+  return NULL;
+}
+
+static int compare_phase(const void *a, const void *b) {
+  int64_t pa = *(const int64_t *)a, pb = *(const int64_t *)b;
+  return (pa > pb) - (pa < pb);
+}
+
+/***************************************************************
+ * Add the results from one worker to the totals
+ **************************************************************/
+static void merge_error_stats(struct error_stats to[4][2], struct error_stats from[4][2]) {
+  int q, o, j;
+
+  for(q = 0; q < 4; q++) {
+    for(o = 0; o < 2; o++) {
+      to[q][o].sum     += from[q][o].sum;
+      to[q][o].abs_sum += from[q][o].abs_sum;
+      if(to[q][o].max < from[q][o].max) to[q][o].max = from[q][o].max;
+      for(j = 0; j < HIST_BINS; j++)
+        to[q][o].hist[j] += from[q][o].hist[j];
+    }
+  }
+}
+
+static void merge_stats(struct sweep_stats *to, struct sweep_stats *from) {
+  struct index_stats *index = from->index;
+  int64_t index_size = from->index_size;
+  int64_t j;
+
+  for(j = 0; j < from->out_of_range; j++)
+    add_bad(to, from->bad[j]);
+  to->total_e += from->total_e;
+  to->count   += from->count;
+  if(to->max < from->max) to->max = from->max;
+  merge_error_stats(to->quadrant, from->quadrant);
+  if(index && to->index) {
+    for(j = 0; j < index_size; j++) {
+      to->index[j].sum   += index[j].sum;
+      to->index[j].count += index[j].count;
+      if(to->index[j].max < index[j].max) to->index[j].max = index[j].max;
+    }
+  }
+  free(from->bad);
+
+  /* The worker keeps its index array for the next section */
+  memset(from, 0, sizeof(struct sweep_stats));
+  if(index) {
+    memset(index, 0, index_size * sizeof(struct index_stats));
+    from->index      = index;
+    from->index_size = index_size;
+  }
+}
+
+/* Give 'st' an array for the errors of each table index */
+static void add_index_stats(const struct test *t, struct sweep_stats *st) {
+  st->index_size = t->cfg.table_size;
+  st->index      = calloc(st->index_size, sizeof(struct index_stats));
+  if(st->index == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+}
+
+/***************************************************************
+ * Workers to test the configuration 't', and a way to run 'fn'
+ * over the phases from 'start' up to (but not including) 'end',
+ * split into one contiguous chunk per thread
+ **************************************************************/
+static struct sweep_worker *new_workers(const struct test *t, long threads) {
+  struct sweep_worker *workers = calloc(threads, sizeof(struct sweep_worker));
+  int i;
+
+  if(workers == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  for(i = 0; i < threads; i++)
+    workers[i].t = t;
+  return workers;
+}
+
+static void run_threads(struct sweep_worker *workers, long threads, int64_t start, int64_t end,
+                        void *(*fn)(void *)) {
+  int64_t chunk = (end - start + threads - 1) / threads;
+  int i;
+
+  for(i = 0; i < threads; i++) {
+    workers[i].start = start + i*chunk < end ? start + i*chunk : end;
+    workers[i].end   = start + (i+1)*chunk < end ? start + (i+1)*chunk : end;
+    if(pthread_create(&workers[i].thread, NULL, fn, &workers[i]) != 0) {
+      fprintf(stderr, "Unable to start thread %i\n", i);
+      exit(1);
+    }
+  }
+  for(i = 0; i < threads; i++)
+    pthread_join(workers[i].thread, NULL);
+}
+
+/***************************************************************
+ * Early abort
+ *
+ * With -A the sweep stops as soon as the max error seen is over
+ * the bound. With -M the mean error is first estimated from
+ * stratified samples (see below), and the sweep isn't started if
+ * even the low end of the estimate's 95% confidence interval is
+ * over the target - so this is an estimate, and one configuration in
+ * 40 that would just meet the target may be dropped. While sweeping
+ * it also stops once the mean error can't come in at or under the
+ * target: as no phase can have an error below zero, the final mean
+ * is at least the total error so far divided by the number of phases
+ * in the whole sweep. The sweep is then run in smaller sections so
+ * this is checked more often.
+ **************************************************************/
+#define ABORT_SECTION_SIZE  ((int64_t)1<<20)
+
+double abort_max  = 0.0;   /* 0 if not set */
+double abort_mean = 0.0;
+
+/* Returns non-zero, and why in 'why', if a sweep with 'remaining' phases still to test can't meet the bounds */
+static int hopeless(const struct sweep_stats *st, int64_t remaining, char *why, size_t len) {
+  double lower;
+
+  if(abort_max > 0.0 && st->max > abort_max) {
+    snprintf(why, len, "max error %g is over the bound of %g", st->max, abort_max);
+    return 1;
+  }
+  lower = st->total_e / (st->count + remaining);
+  if(abort_mean > 0.0 && lower > abort_mean) {
+    snprintf(why, len, "mean error will be at least %.8f, over the target of %g", lower, abort_mean);
+    return 1;
+  }
+  return 0;
+}
+
+/***************************************************************
+ * Checkpoints
+ *
+ * A long sweep is run in sections, and after a section finishes
+ * the totals can be saved to a checkpoint file. If the file
+ * already exists when the program starts, the sweep carries on
+ * from where it got to. The doubles are saved in hex so nothing
+ * is lost, and the configuration is saved so that a checkpoint
+ * from a different build can't be used by mistake.
+ **************************************************************/
+#define SECTION_SIZE        ((int64_t)1<<24)
+#define CHECKPOINT_VERSION  (5)
+
+static void sweep_config(const struct test *t, char *buf, size_t len, int symmetric) {
+  const struct cordic_config *cfg = &t->cfg;
+
+  snprintf(buf, len, "%i %i %i %li %i %i %g %i %i %i %i", cfg->index_bits, cfg->cordic_bits, cfg->cordic_reps,
+           cfg->output_scale, cfg->output_extra_bits, cfg->z_extra_bits, MAX_ERROR, symmetric, use_libm,
+           cfg->hybrid_bits, cfg->tail_from);
+}
+
+static void checkpoint_config(const struct test *t, char *buf, size_t len, int symmetric, int64_t start, int64_t end) {
+  char config[128];
+  sweep_config(t, config, sizeof(config), symmetric);
+  snprintf(buf, len, "%s %li %li", config, start, end);
+}
+
+static void save_checkpoint(const struct test *t, const char *name, int symmetric, int64_t start, int64_t end,
+                            int64_t next, struct sweep_stats *st) {
+  char tmp_name[4096], config[256];
+  FILE *f;
+  int64_t j;
+  int q, o;
+
+  snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name);
+  f = fopen(tmp_name, "w");
+  if(f == NULL) {
+    fprintf(stderr, "Unable to write checkpoint '%s'\n", tmp_name);
+    return;
+  }
+  checkpoint_config(t, config, sizeof(config), symmetric, start, end);
+  fprintf(f, "enhanced_cordic checkpoint %i\n", CHECKPOINT_VERSION);
+  fprintf(f, "config %s\n", config);
+  fprintf(f, "next %li\n", next);
+  fprintf(f, "total_e %a\n", st->total_e);
+  fprintf(f, "max %a\n", st->max);
+  fprintf(f, "count %li\n", st->count);
+  for(q = 0; q < 4; q++) {
+    for(o = 0; o < 2; o++) {
+      const struct error_stats *e = &st->quadrant[q][o];
+
+      fprintf(f, "quadrant %i %i %a %a %a", q, o, e->sum, e->abs_sum, e->max);
+      for(j = 0; j < HIST_BINS; j++)
+        fprintf(f, " %li", e->hist[j]);
+      fprintf(f, "\n");
+    }
+  }
+  fprintf(f, "out_of_range %li\n", st->out_of_range);
+  for(j = 0; j < st->out_of_range; j++)
+    fprintf(f, "%li\n", st->bad[j]);
+
+  /* Only replace the old checkpoint once the new one is complete */
+  if(fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0 || rename(tmp_name, name) != 0)
+    fprintf(stderr, "Unable to write checkpoint '%s'\n", name);
+}
+
+/* Returns the phase to carry on from, or -1 if there is no checkpoint */
+static int64_t load_checkpoint(const struct test *t, const char *name, int symmetric, int64_t start, int64_t end,
+                               struct sweep_stats *st) {
+  char line[256], config[256];
+  int64_t next, out_of_range, j;
+  int version, q, o, fq, fo;
+  FILE *f;
+
+  f = fopen(name, "r");
+  if(f == NULL)
+    return -1;
+
+  checkpoint_config(t, config, sizeof(config), symmetric, start, end);
+  if(fscanf(f, "enhanced_cordic checkpoint %i\n", &version) != 1 || version != CHECKPOINT_VERSION ||
+     fgets(line, sizeof(line), f) == NULL || strncmp(line, "config ", 7) != 0) {
+    fprintf(stderr, "'%s' is not a checkpoint file\n", name);
+    exit(1);
+  }
+  line[strcspn(line, "\n")] = '\0';
+  if(strcmp(line+7, config) != 0) {
+    fprintf(stderr, "Checkpoint '%s' is for a different configuration (%s, this is %s)\n", name, line+7, config);
+    exit(1);
+  }
+  if(fscanf(f, "next %li\n", &next) != 1 ||
+     fscanf(f, "total_e %la\n", &st->total_e) != 1 ||
+     fscanf(f, "max %la\n", &st->max) != 1 ||
+     fscanf(f, "count %li\n", &st->count) != 1) {
+    fprintf(stderr, "Checkpoint '%s' is damaged\n", name);
+    exit(1);
+  }
+  for(q = 0; q < 4; q++) {
+    for(o = 0; o < 2; o++) {
+      struct error_stats *e = &st->quadrant[q][o];
+
+      if(fscanf(f, "quadrant %i %i %la %la %la", &fq, &fo, &e->sum, &e->abs_sum, &e->max) != 5 || fq != q || fo != o) {
+        fprintf(stderr, "Checkpoint '%s' is damaged\n", name);
+        exit(1);
+      }
+      for(j = 0; j < HIST_BINS; j++) {
+        if(fscanf(f, " %li", &e->hist[j]) != 1) {
+          fprintf(stderr, "Checkpoint '%s' is damaged\n", name);
+          exit(1);
+        }
+      }
+      if(fscanf(f, "\n") != 0) {
+        fprintf(stderr, "Checkpoint '%s' is damaged\n", name);
+        exit(1);
+      }
+    }
+  }
+  if(fscanf(f, "out_of_range %li\n", &out_of_range) != 1) {
+    fprintf(stderr, "Checkpoint '%s' is damaged\n", name);
+    exit(1);
+  }
+  for(j = 0; j < out_of_range; j++) {
+    int64_t a;
+    if(fscanf(f, "%li\n", &a) != 1) {
+      fprintf(stderr, "Checkpoint '%s' is damaged\n", name);
+      exit(1);
+    }
+    add_bad(st, a);
+  }
+  fclose(f);
+  return next;
+}
+
+/***************************************************************
+ * Stratified sampling
+ *
+ * For a quick answer when trying out parameters, -r n tests 'n'
+ * random phases from every table block (each quadrant and table
+ * index), rather than every phase. As every block is the same size
+ * the mean error is the mean of the block means, and the spread of
+ * the samples within each block gives a confidence interval for it.
+ * Any block where an error of MAX_ERROR or more is seen is then
+ * swept in full.
+ **************************************************************/
+struct stratum {
+  int64_t n, over;
+  double  sum, sum_sq, max;
+};
+
+int64_t  samples_per_block;
+uint64_t sample_seed = 1;
+
+/* Sample the blocks from 'start' up to (but not including) 'end' */
+static void *sample_blocks(void *arg) {
+  struct sweep_worker *w = arg;
+  const int64_t block_size = (int64_t)1<<w->t->cfg.cordic_bits;
+  int64_t b, j;
+
+  for(b = w->start; b < w->end; b++) {
+    struct stratum *st = &w->strata[b];
+    uint64_t state = sample_seed ^ ((uint64_t)b << 32);  /* Its own stream, whatever the thread count */
+
+    for(j = 0; j < w->samples; j++) {
+      int64_t a = b*block_size + (int64_t)(next_random(&state) & (block_size-1));
+      int64_t s, c;
+      double es, ec, e;
+
+      phase_error(w->t, a, &s, &c, &es, &ec);
+      e = fabs(es) + fabs(ec);
+      st->n++;
+      st->sum    += e;
+      st->sum_sq += e*e;
+      if(st->max < fabs(es)) st->max = fabs(es);
+      if(st->max < fabs(ec)) st->max = fabs(ec);
+      if(fabs(es) >= MAX_ERROR || fabs(ec) >= MAX_ERROR)
+        st->over++;
+    }
+  }
+  return NULL;
+}
+
+/* The mean error, as the mean of the block means, and the variance of that from the spread within each block */
+static void strata_mean(const struct stratum *strata, int64_t blocks, double *mean, double *var) {
+  int64_t b;
+
+  *mean = *var = 0.0;
+  for(b = 0; b < blocks; b++) {
+    const struct stratum *st = &strata[b];
+    double m = st->sum / st->n;
+
+    *mean += m / blocks;
+    if(st->n > 1)
+      *var += (st->sum_sq - st->n*m*m) / (st->n-1) / st->n / ((double)blocks*blocks);
+  }
+}
+
+static void sample_report(const struct test *t, long threads) {
+  const struct cordic_config *cfg = &t->cfg;
+  const int64_t blocks = 4*cfg->table_size, block_size = (int64_t)1<<cfg->cordic_bits;
+  struct sweep_worker *workers;
+  struct stratum *strata;
+  double mean, var, max = 0.0, p, upper;
+  int64_t b, n = 0, over = 0, flagged = 0;
+  int i;
+
+  if(threads > blocks) threads = blocks;
+  strata = calloc(blocks, sizeof(struct stratum));
+  if(strata == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  workers = new_workers(t, threads);
+  for(i = 0; i < threads; i++) {
+    workers[i].strata  = strata;
+    workers[i].samples = samples_per_block;
+  }
+  run_threads(workers, threads, 0, blocks, sample_blocks);
+
+  strata_mean(strata, blocks, &mean, &var);
+  for(b = 0; b < blocks; b++) {
+    if(max < strata[b].max) max = strata[b].max;
+    n    += strata[b].n;
+    over += strata[b].over;
+  }
+
+  /* Upper 95% bound on the fraction of phases with an error of MAX_ERROR or
+   * more - the "rule of three" if none were seen, otherwise Wilson's interval */
+  p = (double)over / n;
+  if(over == 0)
+    upper = 3.0 / n;
+  else
+    upper = (p + 1.96*1.96/(2*n) + 1.96*sqrt(p*(1-p)/n + 1.96*1.96/(4.0*n*n))) / (1 + 1.96*1.96/n);
+
+  printf("Sampled %li phases from each of %li blocks (%li phases, %.4f%% of the circle)\n",
+         samples_per_block, blocks, n, 100.0*n/cfg->full_circle);
+  printf("Error is %13.11f +/- %13.11f per calcuation out of +/-%li (95%% confidence)\n",
+         mean, 1.96*sqrt(var), cfg->output_scale);
+  printf("Max error seen is %13.11f, %li samples had errors of %g or more (at most %.6f%% of phases, 95%% confidence)\n",
+         max, over, MAX_ERROR, 100.0*upper);
+
+  /* Sweep any block that had an out of range error in full */
+  for(b = 0; b < blocks; b++) {
+    struct sweep_stats block;
+
+    if(strata[b].over == 0)
+      continue;
+    flagged++;
+    memset(&block, 0, sizeof(block));
+    run_threads(workers, threads, b*block_size, (b+1)*block_size, sweep);
+    for(i = 0; i < threads; i++)
+      merge_stats(&block, &workers[i].stats);
+    printf("Block %li (quadrant %li, index %li): error is %13.11f per calcuation, max error is %13.11f, occured %li times\n",
+           b, b / cfg->table_size, b % cfg->table_size, block.total_e/block.count, block.max, block.out_of_range);
+    free(block.bad);
+  }
+  if(flagged)
+    printf("%li of %li blocks were swept in full\n", flagged, blocks);
+  free(workers);
+  free(strata);
+}
+
+/***************************************************************
+ * For -M, before sweeping: estimate the mean error from
+ * MEAN_ESTIMATE_SAMPLES samples from each block, and return
+ * non-zero (with why in 'why') if even the low end of its 95%
+ * confidence interval is over the target
+ **************************************************************/
+#define MEAN_ESTIMATE_SAMPLES (16)
+
+static int mean_estimate_hopeless(const struct test *t, long threads, char *why, size_t len) {
+  const int64_t blocks = 4*t->cfg.table_size;
+  struct sweep_worker *workers;
+  struct stratum *strata;
+  double mean, var;
+  int i;
+
+  if(abort_mean <= 0.0)
+    return 0;
+  if(threads > blocks) threads = blocks;
+  strata = calloc(blocks, sizeof(struct stratum));
+  if(strata == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  workers = new_workers(t, threads);
+  for(i = 0; i < threads; i++) {
+    workers[i].strata  = strata;
+    workers[i].samples = MEAN_ESTIMATE_SAMPLES;
+  }
+  run_threads(workers, threads, 0, blocks, sample_blocks);
+  strata_mean(strata, blocks, &mean, &var);
+  free(workers);
+  free(strata);
+
+  if(mean - 1.96*sqrt(var) > abort_mean) {
+    snprintf(why, len, "mean error estimated at %.5f +/- %.5f (95%% confidence), over the target of %g",
+             mean, 1.96*sqrt(var), abort_mean);
+    return 1;
+  }
+  return 0;
+}
+
+/***************************************************************
+ * Shard summaries
+ *
+ * A sweep can be split into shards with -s i/N, each covering
+ * 1/N of the phases, to be run as separate processes or on other
+ * machines. With -o each shard writes its totals and bad phases to
+ * a binary summary, and -m merges the summaries back into the
+ * report that a single run would print. The summaries are in the
+ * machine's byte order, and must all come from the same build.
+ **************************************************************/
+#define SUMMARY_MAGIC   "ECSUMRY"
+#define SUMMARY_VERSION (2)
+
+struct summary_header {
+  char    magic[8];
+  int32_t version;
+  int32_t shard, shards;
+  int32_t symmetric, libm;
+  char    config[128];
+  int64_t start, end;
+  double  total_e, max;
+  int64_t count, out_of_range;
+  struct error_stats quadrant[4][2];
+};
+
+static void shard_range(int64_t range, int shard, int shards, int64_t *start, int64_t *end) {
+  *start = range * shard / shards;
+  *end   = range * (shard+1) / shards;
+}
+
+static int write_summary(const struct test *t, const char *name, int symmetric, int shard, int shards,
+                         int64_t start, int64_t end, struct sweep_stats *st) {
+  struct summary_header h;
+  FILE *f;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SUMMARY_MAGIC, sizeof(h.magic));
+  h.version      = SUMMARY_VERSION;
+  h.shard        = shard;
+  h.shards       = shards;
+  h.symmetric    = symmetric;
+  h.libm         = use_libm;
+  sweep_config(t, h.config, sizeof(h.config), symmetric);
+  h.start        = start;
+  h.end          = end;
+  h.total_e      = st->total_e;
+  h.max          = st->max;
+  h.count        = st->count;
+  h.out_of_range = st->out_of_range;
+  memcpy(h.quadrant, st->quadrant, sizeof(h.quadrant));
+
+  f = fopen(name, "wb");
+  if(f == NULL ||
+     fwrite(&h, sizeof(h), 1, f) != 1 ||
+     fwrite(st->bad, sizeof(int64_t), st->out_of_range, f) != (size_t)st->out_of_range ||
+     fclose(f) != 0) {
+    fprintf(stderr, "Unable to write summary '%s'\n", name);
+    return -1;
+  }
+  return 0;
+}
+
+static int compare_shard(const void *a, const void *b) {
+  const struct summary_header *ha = a, *hb = b;
+  return ha->shard - hb->shard;
+}
+
+/* Merge the summaries in 'names' into 'totals', checking that they cover the whole sweep */
+static int merge_summaries(const struct test *t, char **names, int n, struct sweep_stats *totals) {
+  struct summary_header *h;
+  FILE *f = NULL;
+  char config[128];
+  int64_t range;
+  int i, result = -1;
+
+  h = calloc(n, sizeof(struct summary_header));
+  if(h == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  for(i = 0; i < n; i++) {
+    int64_t j;
+
+    f = fopen(names[i], "rb");
+    if(f == NULL || fread(&h[i], sizeof(h[i]), 1, f) != 1 ||
+       memcmp(h[i].magic, SUMMARY_MAGIC, sizeof(h[i].magic)) != 0 || h[i].version != SUMMARY_VERSION) {
+      fprintf(stderr, "'%s' is not a summary file\n", names[i]);
+      goto done;
+    }
+    /* The working for bad phases must be printed with the same reference */
+    use_libm = h[i].libm;
+    sweep_config(t, config, sizeof(config), h[i].symmetric);
+    if(strcmp(h[i].config, config) != 0) {
+      fprintf(stderr, "'%s' is for a different configuration (%s, this is %s)\n", names[i], h[i].config, config);
+      goto done;
+    }
+    if(i > 0 && (strcmp(h[i].config, h[0].config) != 0 || h[i].shards != h[0].shards)) {
+      fprintf(stderr, "'%s' is not from the same sweep as '%s'\n", names[i], names[0]);
+      goto done;
+    }
+    for(j = 0; j < h[i].out_of_range; j++) {
+      int64_t a;
+      if(fread(&a, sizeof(a), 1, f) != 1) {
+        fprintf(stderr, "Summary '%s' is damaged\n", names[i]);
+        goto done;
+      }
+      add_bad(totals, a);
+    }
+    fclose(f);
+    f = NULL;
+
+    totals->total_e += h[i].total_e;
+    totals->count   += h[i].count;
+    if(totals->max < h[i].max) totals->max = h[i].max;
+    merge_error_stats(totals->quadrant, h[i].quadrant);
+  }
+
+  /* Every shard must be there exactly once */
+  qsort(h, n, sizeof(struct summary_header), compare_shard);
+  for(i = 0; i < n; i++) {
+    if(h[i].shard != i || (i > 0 && h[i].start != h[i-1].end)) {
+      fprintf(stderr, "Shard %i of %i is missing or duplicated\n", i, h[0].shards);
+      goto done;
+    }
+  }
+  if(n != h[0].shards || h[0].start != 0) {
+    fprintf(stderr, "Only %i of %i shards were given\n", n, h[0].shards);
+    goto done;
+  }
+  /* ...and together they must cover every phase (the first quadrant, if symmetric) */
+  range = h[0].symmetric ? t->cfg.full_circle/4 : t->cfg.full_circle;
+  if(h[n-1].end != range) {
+    fprintf(stderr, "The shards end at phase %li, not %li, so the sweep is incomplete\n", h[n-1].end, range);
+    goto done;
+  }
+  result = 0;
+
+done:
+  if(f != NULL)
+    fclose(f);
+  free(h);
+  return result;
+}
+
+/***************************************************************
+ * Design space exploration
+ *
+ * With -x, every combination of the -I, -R, -E and -Z ranges is
+ * set up and tested, keeping the phase at the same number of bits
+ * (so CORDIC_BITS shrinks as INDEX_BITS grows). The configurations
+ * are shared out over the threads, each one being set up and swept
+ * (or sampled, with -r) by a single thread. The results are then
+ * printed with the Pareto frontier of table size, iterations and
+ * error marked - the configurations that no other one beats or
+ * equals on all three. Sweeps stopped early by -A or -M have missed
+ * the error budget, so are left off the frontier.
+ **************************************************************/
+struct range {
+  int lo, hi;
+};
+
+struct explore_run {
+  struct test t;
+  int     valid;
+  int     table_width;     /* Bits in each table entry */
+  int64_t table_bits;      /* Total size of the table */
+  double  mean, max;
+  int64_t out_of_range;
+  int     aborted;         /* The configuration can't meet -A or -M */
+  int64_t stopped;         /* The phase the sweep stopped at, or 0 if the estimate ruled it out first */
+  char    why[128];
+  int     frontier;
+};
+
+struct explore {
+  struct explore_run *runs;
+  int                 n, next;
+  pthread_mutex_t     lock;
+};
+
+static int parse_range(const char *arg, struct range *r) {
+  int n = sscanf(arg, "%i-%i", &r->lo, &r->hi);
+
+  if(n == 1)
+    r->hi = r->lo;
+  return n >= 1 && r->lo <= r->hi ? 0 : -1;
+}
+
+static void explore_one(struct explore_run *run) {
+  struct test *t = &run->t;
+  struct sweep_worker w;
+  int64_t i, largest = 0;
+  double var;
+
+  if(test_setup(t) != 0)
+    return;
+  run->valid = 1;
+
+  for(i = 0; i < t->cfg.table_size; i++)
+    if(largest < cordic_table_entry(&t->cfg, i)) largest = cordic_table_entry(&t->cfg, i);
+  for(run->table_width = 1; (largest >> run->table_width) != 0; run->table_width++)
+    ;
+  run->table_bits = t->cfg.table_size * run->table_width;
+
+  memset(&w, 0, sizeof(w));
+  w.t = t;
+  if(samples_per_block > 0) {
+    w.end     = 4*t->cfg.table_size;
+    w.samples = samples_per_block;
+    w.strata  = calloc(w.end, sizeof(struct stratum));
+    if(w.strata == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    sample_blocks(&w);
+    strata_mean(w.strata, w.end, &run->mean, &var);
+    for(i = 0; i < w.end; i++) {
+      if(run->max < w.strata[i].max) run->max = w.strata[i].max;
+      run->out_of_range += w.strata[i].over;
+    }
+    free(w.strata);
+  } else {
+    int64_t section = abort_max > 0.0 || abort_mean > 0.0 ? ABORT_SECTION_SIZE : t->cfg.full_circle;
+
+    if(mean_estimate_hopeless(t, 1, run->why, sizeof(run->why))) {
+      run->aborted = 1;
+      test_free(t);
+      return;
+    }
+    w.stats.count_only = 1;
+    for(w.start = 0; w.start < t->cfg.full_circle; w.start = w.end) {
+      w.end = w.start + section < t->cfg.full_circle ? w.start + section : t->cfg.full_circle;
+      sweep(&w);
+      if(w.end < t->cfg.full_circle && hopeless(&w.stats, t->cfg.full_circle - w.end, run->why, sizeof(run->why))) {
+        run->stopped = w.end;
+        run->aborted = 1;
+        break;
+      }
+    }
+    run->mean         = w.stats.total_e / w.stats.count;
+    run->max          = w.stats.max;
+    run->out_of_range = w.stats.out_of_range;
+  }
+  test_free(t);
+}
+
+static void *explore_thread(void *arg) {
+  struct explore *e = arg;
+
+  for(;;) {
+    int i;
+
+    pthread_mutex_lock(&e->lock);
+    i = e->next++;
+    pthread_mutex_unlock(&e->lock);
+    if(i >= e->n)
+      break;
+    explore_one(&e->runs[i]);
+  }
+  return NULL;
+}
+
+/* Does 'a' beat or equal 'b' on table size, iterations and error, and beat it on one of them? */
+static int dominates(const struct explore_run *a, const struct explore_run *b, int by_mean) {
+  double ea = by_mean ? a->mean : a->max, eb = by_mean ? b->mean : b->max;
+
+  if(a->table_bits > b->table_bits || a->t.cfg.cordic_reps > b->t.cfg.cordic_reps || ea > eb)
+    return 0;
+  return a->table_bits < b->table_bits || a->t.cfg.cordic_reps < b->t.cfg.cordic_reps || ea < eb;
+}
+
+static int explore(const struct test *base, long threads, int phase_bits, const struct range *index,
+                   const struct range *reps, const struct range *extra, const struct range *zextra, int by_mean) {
+  struct explore e;
+  pthread_t *thread;
+  int i, j, n, ix, r, x, z, stopped = 0;
+
+  memset(&e, 0, sizeof(e));
+  n = (index->hi-index->lo+1) * (reps->hi-reps->lo+1) * (extra->hi-extra->lo+1) * (zextra->hi-zextra->lo+1);
+  e.runs = calloc(n, sizeof(struct explore_run));
+  thread = calloc(threads, sizeof(pthread_t));
+  if(e.runs == NULL || thread == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  for(ix = index->lo; ix <= index->hi; ix++)
+    for(r = reps->lo; r <= reps->hi; r++)
+      for(x = extra->lo; x <= extra->hi; x++)
+        for(z = zextra->lo; z <= zextra->hi; z++) {
+          struct cordic_config *cfg = &e.runs[e.n++].t.cfg;
+
+          *cfg = base->cfg;
+          cfg->index_bits        = ix;
+          cfg->cordic_bits       = phase_bits - ix;
+          cfg->cordic_reps       = r;
+          cfg->output_extra_bits = x;
+          cfg->z_extra_bits      = z;
+          cfg->verbose           = 0;
+          cfg->table_file        = NULL;    /* A table file is for one configuration */
+          cfg->threads           = 1;       /* The runs are already spread over the threads */
+        }
+
+  printf("Exploring %i configurations of %i bit phases (plus 2 quadrant bits) on %li threads%s\n",
+         n, phase_bits, threads, samples_per_block > 0 ? ", sampled" : "");
+  fflush(stdout);
+
+  pthread_mutex_init(&e.lock, NULL);
+  if(threads > n) threads = n;
+  for(i = 0; i < threads; i++) {
+    if(pthread_create(&thread[i], NULL, explore_thread, &e) != 0) {
+      fprintf(stderr, "Unable to start thread %i\n", i);
+      exit(1);
+    }
+  }
+  for(i = 0; i < threads; i++)
+    pthread_join(thread[i], NULL);
+  pthread_mutex_destroy(&e.lock);
+
+  for(i = 0; i < n; i++) {
+    if(e.runs[i].aborted)
+      stopped++;
+    e.runs[i].frontier = e.runs[i].valid && !e.runs[i].aborted;
+    for(j = 0; j < n && e.runs[i].frontier; j++)
+      if(e.runs[j].valid && !e.runs[j].aborted && dominates(&e.runs[j], &e.runs[i], by_mean))
+        e.runs[i].frontier = 0;
+  }
+
+  printf("\n  INDEX CORDIC  REPS EXTRA Z_EXTRA  TABLE_BITS WIDTH     MEAN_ERROR  MAX_ERROR  OUT_OF_RANGE\n");
+  for(i = 0; i < n; i++) {
+    const struct explore_run *run = &e.runs[i];
+    const struct cordic_config *cfg = &run->t.cfg;
+
+    printf("%c %5i %6i %5i %5i %7i", run->frontier ? '*' : ' ', cfg->index_bits, cfg->cordic_bits,
+           cfg->cordic_reps, cfg->output_extra_bits, cfg->z_extra_bits);
+    if(run->valid && !(run->aborted && run->stopped == 0))
+      printf("  %10li %5i %14.11f %10.5f  %12li", run->table_bits, run->table_width, run->mean, run->max, run->out_of_range);
+    if(run->aborted && run->stopped == 0)
+      printf("  %10li %5i  not swept, %s\n", run->table_bits, run->table_width, run->why);
+    else if(run->aborted)
+      printf("  stopped at phase %li, %s\n", run->stopped, run->why);
+    else if(run->valid)
+      printf("\n");
+    else
+      printf("  invalid configuration\n");
+  }
+  printf("\n* is on the Pareto frontier of table bits, iterations and %s error", by_mean ? "mean" : "max");
+  if(stopped)
+    printf(", out of the %i configurations that weren't stopped early", n - stopped);
+  printf("\n");
+
+  free(thread);
+  free(e.runs);
+  return 0;
+}
+
+/***************************************************************
+ * Signed error histograms
+ *
+ * With -H the SIN and COS errors for each quadrant are written out
+ * as JSON if the file name ends in ".json", otherwise as CSV with
+ * one line per quadrant and output. A positive error means the
+ * result is larger than it should be, so any bias (for example from
+ * the rounding offset in the table) shows as a mean away from zero.
+ * The end bins also count all the errors beyond them.
+ **************************************************************/
+static int write_histograms(const char *name, const struct sweep_stats *st) {
+  static const char *output[2] = {"sin", "cos"};
+  const char *ext = strrchr(name, '.');
+  int json = ext != NULL && strcmp(ext, ".json") == 0;
+  FILE *f;
+  int q, o, j;
+
+  f = fopen(name, "w");
+  if(f == NULL) {
+    fprintf(stderr, "Unable to write histograms '%s'\n", name);
+    return -1;
+  }
+
+  if(json) {
+    fprintf(f, "{\n  \"hist_limit\": %i,\n  \"quadrants\": [\n", HIST_LIMIT);
+  } else {
+    fprintf(f, "quadrant,output,count,mean,mean_abs,max_abs");
+    for(j = 0; j < HIST_BINS; j++)
+      fprintf(f, ",%s%i", j == 0 ? "<=" : j == HIST_BINS-1 ? ">=" : "", j-HIST_LIMIT);
+    fprintf(f, "\n");
+  }
+
+  for(q = 0; q < 4; q++) {
+    if(json)
+      fprintf(f, "    {\"quadrant\": %i", q);
+    for(o = 0; o < 2; o++) {
+      const struct error_stats *e = &st->quadrant[q][o];
+      int64_t count = 0;
+
+      for(j = 0; j < HIST_BINS; j++)
+        count += e->hist[j];
+      if(json)
+        fprintf(f, ",\n     \"%s\": {\"count\": %li, \"mean\": %.12g, \"mean_abs\": %.12g, \"max_abs\": %g, \"hist\": [",
+                output[o], count, count ? e->sum/count : 0.0, count ? e->abs_sum/count : 0.0, e->max);
+      else
+        fprintf(f, "%i,%s,%li,%.12g,%.12g,%g", q, output[o], count,
+                count ? e->sum/count : 0.0, count ? e->abs_sum/count : 0.0, e->max);
+      for(j = 0; j < HIST_BINS; j++)
+        fprintf(f, json && j == 0 ? "%li" : json ? ", %li" : ",%li", e->hist[j]);
+      fprintf(f, json ? "]}" : "\n");
+    }
+    if(json)
+      fprintf(f, "}%s\n", q < 3 ? "," : "");
+  }
+  if(json)
+    fprintf(f, "  ]\n}\n");
+
+  if(fclose(f) != 0) {
+    fprintf(stderr, "Unable to write histograms '%s'\n", name);
+    return -1;
+  }
+  return 0;
+}
+
+/***************************************************************
+ * Table index heatmap
+ *
+ * With -P the mean and max error for each table index (the
+ * INDEX_MASK field of the phase, over all four quadrants) are
+ * written out, as CSV or, if the file name ends in ".bin", as a
+ * compact binary file: a heatmap_header then a pair of floats
+ * (mean, max) for each index, in the machine's byte order. The
+ * mean is per calculation, as in the report.
+ **************************************************************/
+#define HEATMAP_MAGIC   "ECHEAT"
+#define HEATMAP_VERSION (1)
+
+struct heatmap_header {
+  char    magic[8];
+  int32_t version;
+  int32_t index_bits, cordic_bits, cordic_reps;
+};
+
+static int write_heatmap(const struct test *t, const char *name, const struct sweep_stats *st) {
+  const char *ext = strrchr(name, '.');
+  int binary = ext != NULL && strcmp(ext, ".bin") == 0;
+  int ok = 1;
+  FILE *f;
+  int64_t i;
+
+  f = fopen(name, binary ? "wb" : "w");
+  if(f == NULL) {
+    fprintf(stderr, "Unable to write heatmap '%s'\n", name);
+    return -1;
+  }
+
+  if(binary) {
+    struct heatmap_header h;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HEATMAP_MAGIC, sizeof(HEATMAP_MAGIC));
+    h.version     = HEATMAP_VERSION;
+    h.index_bits  = t->cfg.index_bits;
+    h.cordic_bits = t->cfg.cordic_bits;
+    h.cordic_reps = t->cfg.cordic_reps;
+    ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  } else {
+    fprintf(f, "index,count,mean,max\n");
+  }
+
+  for(i = 0; i < st->index_size && ok; i++) {
+    const struct index_stats *e = &st->index[i];
+    double mean = e->count ? e->sum / e->count : 0.0;
+
+    if(binary) {
+      float v[2];
+      v[0] = mean;
+      v[1] = e->max;
+      ok = fwrite(v, sizeof(v), 1, f) == 1;
+    } else {
+      fprintf(f, "%li,%li,%.12g,%g\n", i, e->count, mean, e->max);
+    }
+  }
+
+  if(fclose(f) != 0 || !ok) {
+    fprintf(stderr, "Unable to write heatmap '%s'\n", name);
+    return -1;
+  }
+  return 0;
+}
+
+/***************************************************************
+ * Print the working of any bad values in phase order, and the
+ * error totals
+ **************************************************************/
+static void report(const struct test *t, struct sweep_stats *totals) {
+  struct cordic_trace_record *trace;
+  int64_t j;
+
+  trace = malloc((t->cfg.cordic_reps+1) * sizeof(struct cordic_trace_record));
+  if(trace == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  qsort(totals->bad, totals->out_of_range, sizeof(int64_t), compare_phase);
+  for(j = 0; j < totals->out_of_range; j++) {
+    int64_t a = totals->bad[j], s, c;
+    double es,ec;
+
+    phase_error(t, a, &s, &c, &es, &ec);
+    cordic_sine_cosine_trace(&t->cfg, a, &s, &c, trace);
+    print_trace(&t->cfg, trace);
+    printf("%10li  => %10li, %10li  (error %10f, %10f)\n\n", a, s, c, es, ec);
+  }
+  free(trace);
+
+  printf("Error is %13.11f per calcuation out of +/-%li\n",totals->total_e/totals->count, t->cfg.output_scale);
+  printf("Max error is %13.11f, occured %li times\n",totals->max, totals->out_of_range);
+}
+
+/**************************************************************/
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-t threads] [-q] [-b] [-l] [-p] [-k default|branch-free]\n"
+                  "          [-T wide|packed|paired] [-g auto|normal|huge] [-F table_file] [-Y hybrid_bits]\n"
+                  "          [-u tail_from]\n", name);
+  fprintf(stderr, "          [-c checkpoint_file] [-i seconds] [-s shard/shards] [-o summary_file]\n");
+  fprintf(stderr, "          [-r samples_per_block] [-S seed]\n");
+  fprintf(stderr, "          [-I index_bits] [-C cordic_bits] [-R cordic_reps] [-O output_scale]\n");
+  fprintf(stderr, "          [-E output_extra_bits] [-Z z_extra_bits] [-A max_error] [-M mean_error]\n");
+  fprintf(stderr, "          [-H histogram_file] [-P heatmap_file]\n");
+  fprintf(stderr, "       %s -x max|mean [-t threads] [-r samples_per_block] [-A max_error] [-M mean_error]\n", name);
+  fprintf(stderr, "          [-C cordic_bits] [-O output_scale]\n");
+  fprintf(stderr, "          [-I index_bits[-index_bits]] [-R reps[-reps]] [-E extra_bits[-extra_bits]] [-Z z_extra_bits[-z_extra_bits]]\n");
+  fprintf(stderr, "       %s [-H histogram_file] -m summary_file...\n", name);
+  fprintf(stderr, "-M is checked against an estimate of the mean error from samples, to 95%% confidence,\n"
+                  "before sweeping, and against the smallest it can still be while sweeping\n");
+  exit(1);
 }
 
 /**************************************************************/
 int main(int argc, char *argv[]) {
-  int64_t a = 0.8;
-  double max = 0.0;
-  double total_e = 0.0;
-  int64_t count = 0;
-  int64_t out_of_range = 0;
-  setup();
-
-  if(FULL_CIRCLE > 20000000) {
+  struct test test, *t = &test;
+  struct sweep_worker *workers;
+  struct sweep_stats totals;
+  struct perf_totals setup_counts, kernel_counts, reference_counts;
+  void *(*sweep_fn)(void *) = sweep;
+  const char *checkpoint = NULL, *summary = NULL, *histograms = NULL, *heatmap = NULL;
+  double interval = 60.0, last_save;
+  int64_t range, start, end, next, section;
+  char why[128];
+  long threads;
+  struct range index, reps, extra, zextra;
+  int i, opt, symmetric = 0, batch_check = 0, merge = 0, explore_by = 0;
+  int shard = 0, shards = 1, stopped = 0;
+
+  memset(&test, 0, sizeof(test));
+  memset(&setup_counts, 0, sizeof(setup_counts));
+  memset(&kernel_counts, 0, sizeof(kernel_counts));
+  memset(&reference_counts, 0, sizeof(reference_counts));
+  t->cfg.index_bits        = INDEX_BITS;
+  t->cfg.cordic_bits       = CORDIC_BITS;
+  t->cfg.cordic_reps       = CORDIC_REPS;
+  t->cfg.output_scale      = OUTPUT_SCALE;
+  t->cfg.output_extra_bits = OUTPUT_EXTRA_BITS;
+  t->cfg.z_extra_bits      = Z_EXTRA_BITS;
+  t->cfg.verbose           = 1;
+  index.lo  = index.hi  = INDEX_BITS;
+  reps.lo   = reps.hi   = CORDIC_REPS;
+  extra.lo  = extra.hi  = OUTPUT_EXTRA_BITS;
+  zextra.lo = zextra.hi = Z_EXTRA_BITS;
+
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+  while((opt = getopt(argc, argv, "t:qblc:i:s:o:mr:S:I:C:R:O:E:Z:x:A:M:H:P:pk:T:F:g:Y:u:")) != -1) {
+    switch(opt) {
+      case 't': threads = atol(optarg);    break;
+      case 'q': symmetric = 1;             break;
+      case 'b': batch_check = 1;           break;
+      case 'l': use_libm = 1;              break;
+      case 'p': use_perf = 1;              break;
+      case 'k':
+        for(t->cfg.kernel = 0; t->cfg.kernel < CORDIC_KERNELS; t->cfg.kernel++)
+          if(strcmp(optarg, cordic_kernel_names[t->cfg.kernel]) == 0)
+            break;
+        if(t->cfg.kernel == CORDIC_KERNELS)
+          usage(argv[0]);
+        break;
+      case 'T':
+        for(t->cfg.storage = 0; t->cfg.storage < CORDIC_STORAGES; t->cfg.storage++)
+          if(strcmp(optarg, cordic_storage_names[t->cfg.storage]) == 0)
+            break;
+        if(t->cfg.storage == CORDIC_STORAGES)
+          usage(argv[0]);
+        break;
+      case 'g':
+        for(t->cfg.pages = 0; t->cfg.pages < CORDIC_PAGE_KINDS; t->cfg.pages++)
+          if(strcmp(optarg, cordic_page_names[t->cfg.pages]) == 0)
+            break;
+        if(t->cfg.pages == CORDIC_PAGE_KINDS)
+          usage(argv[0]);
+        break;
+      case 'F': t->cfg.table_file = optarg; break;
+      case 'Y': t->cfg.hybrid_bits = atoi(optarg); break;
+      case 'u': t->cfg.tail_from   = atoi(optarg); break;
+      case 'c': checkpoint = optarg;       break;
+      case 'i': interval = atof(optarg);   break;
+      case 'o': summary = optarg;          break;
+      case 'H': histograms = optarg;       break;
+      case 'P': heatmap = optarg;          break;
+      case 'm': merge = 1;                 break;
+      case 'r':
+        /* At least two, or there's no spread within a block to give a confidence interval */
+        if((samples_per_block = atol(optarg)) < 2)
+          usage(argv[0]);
+        break;
+      case 'S': sample_seed = strtoull(optarg, NULL, 0);   break;
+      case 'A': abort_max  = atof(optarg);  break;
+      case 'M': abort_mean = atof(optarg);  break;
+      case 'C': t->cfg.cordic_bits       = atoi(optarg);   break;
+      case 'O': t->cfg.output_scale      = strtoll(optarg, NULL, 0); break;
+      case 'I': if(parse_range(optarg, &index)  != 0) usage(argv[0]); break;
+      case 'R': if(parse_range(optarg, &reps)   != 0) usage(argv[0]); break;
+      case 'E': if(parse_range(optarg, &extra)  != 0) usage(argv[0]); break;
+      case 'Z': if(parse_range(optarg, &zextra) != 0) usage(argv[0]); break;
+      case 'x':
+        if(strcmp(optarg, "max") == 0)       explore_by = 1;
+        else if(strcmp(optarg, "mean") == 0) explore_by = 2;
+        else usage(argv[0]);
+        break;
+      case 's':
+        if(sscanf(optarg, "%i/%i", &shard, &shards) != 2 || shards < 1 || shard < 0 || shard >= shards)
+          usage(argv[0]);
+        break;
+      default:  usage(argv[0]);
+    }
+  }
+  if(merge == (optind == argc))
+    usage(argv[0]);
+  if(heatmap && (merge || checkpoint || summary)) {
+    fprintf(stderr, "The heatmap isn't kept in checkpoints or summaries, so -P can't be used with -c, -o or -m\n");
+    return 1;
+  }
+  if(threads < 1)
+    threads = 1;
+
+  t->cfg.threads           = threads;
+  t->cfg.index_bits        = index.lo;
+  t->cfg.cordic_reps       = reps.lo;
+  t->cfg.output_extra_bits = extra.lo;
+  t->cfg.z_extra_bits      = zextra.lo;
+  if(explore_by)
+    return explore(t, threads, index.lo + t->cfg.cordic_bits, &index, &reps, &extra, &zextra, explore_by == 2) ? 1 : 0;
+  if(index.lo != index.hi || reps.lo != reps.hi || extra.lo != extra.hi || zextra.lo != zextra.hi)
+    usage(argv[0]);
+
+  if(use_perf) {
+    struct perf_counters pc;
+    struct perf_reading before, after;
+
+    if(perf_open(&pc) == 0) {
+      fprintf(stderr, "Hardware counters are not available (%s), carrying on without them\n", perf_error());
+      use_perf = 0;
+    } else {
+      perf_read(&pc, &before);
+      if(test_setup(t) != 0)
+        return 1;
+      perf_read(&pc, &after);
+      perf_add(&setup_counts, &before, &after);
+      perf_close(&pc);
+    }
+  }
+  if(!use_perf && test_setup(t) != 0)
+    return 1;
+
+  memset(&totals, 0, sizeof(totals));
+  if(merge) {
+    if(merge_summaries(t, argv+optind, argc-optind, &totals) != 0)
+      return 1;
+    report(t, &totals);
+    if(histograms && write_histograms(histograms, &totals) != 0)
+      return 1;
+    free(totals.bad);
+    test_free(t);
+    return 0;
+  }
+
+  if(samples_per_block > 0) {
+    sample_report(t, threads);
+    test_free(t);
+    return 0;
+  }
+
+  range = t->cfg.full_circle;
+  if(batch_check) {
+    sweep_fn = check_batch;
+  } else if(symmetric) {
+    if(check_symmetry(t) == 0) {
+      /* Only the first quadrant needs to be tested */
+      sweep_fn = sweep_symmetric;
+      range    = t->cfg.full_circle/4;
+    } else {
+      printf("Quadrant symmetry does not hold, testing all quadrants\n");
+      symmetric = 0;
+    }
+  }
+  shard_range(range, shard, shards, &start, &end);
+  if(threads > end - start)   threads = end - start > 0 ? end - start : 1;
+
+  if(end - start > 20000000) {
     printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
     printf("!! INPUT_BITS is very large, so this may take a long time to prove all test cases\n");
     printf("!! Please wait........................\n");
     printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
   }
-  for(a = 0; a < FULL_CIRCLE; a++) {
-    int64_t s, c;
-    double es,ec;
+  fflush(stdout);
+
+  workers = new_workers(t, threads);
+  if(heatmap) {
+    add_index_stats(t, &totals);
+    for(i = 0; i < threads; i++)
+      add_index_stats(t, &workers[i].stats);
+  }
+
+  if(batch_check) {
+    int64_t mismatches = 0;
+    double scalar_time = 0.0, batch_time = 0.0;
+
+    run_threads(workers, threads, start, end, check_batch);
+    for(i = 0; i < threads; i++) {
+      mismatches  += workers[i].mismatches;
+      scalar_time += workers[i].scalar_time;
+      batch_time  += workers[i].batch_time;
+    }
+    free(workers);
+    test_free(t);
+    printf("Batch kernel differs from cordic_sine_cosine() for %li of %li phases\n", mismatches, end-start);
+    printf("cordic_sine_cosine()       %8.3f ns per phase\n", scalar_time*1e9/(end-start));
+    printf("cordic_sine_cosine_batch() %8.3f ns per phase\n", batch_time*1e9/(end-start));
+    return mismatches ? 1 : 0;
+  }
+
+  if(mean_estimate_hopeless(t, threads, why, sizeof(why))) {
+    printf("Not swept: %s\n", why);
+    free(workers);
+    test_free(t);
+    return 2;
+  }
+
+  next = start;
+  if(checkpoint) {
+    next = load_checkpoint(t, checkpoint, symmetric, start, end, &totals);
+    if(next < 0)
+      next = start;
+    else
+      printf("Resuming from phase %li of %li\n", next, end);
+  }
 
-    cordic_sine_cosine(a, &s, &c, 0);
-    es = s-(int64_t)(sin(a*(2*PI/FULL_CIRCLE))*(OUTPUT_SCALE)-0.5);
-    ec = c-(int64_t)(cos(a*(2*PI/FULL_CIRCLE))*(OUTPUT_SCALE)-0.5);
+  /* Sweep the range a section at a time, so progress can be saved */
+  last_save = seconds();
+  section = abort_max > 0.0 || abort_mean > 0.0 ? ABORT_SECTION_SIZE : SECTION_SIZE;
+  while(next < end) {
+    int64_t section_end = next + section < end ? next + section : end;
 
-    if(es >= MAX_ERROR || es <= -MAX_ERROR || ec >= MAX_ERROR || ec <= -MAX_ERROR) {
-      out_of_range++;
-      cordic_sine_cosine(a, &s, &c, 1);
-      printf("%10li  => %10li, %10li  (error %10f, %10f)\n\n", a, s, c, es, ec);
+    run_threads(workers, threads, next, section_end, sweep_fn);
+    for(i = 0; i < threads; i++) {
+      merge_stats(&totals, &workers[i].stats);
+      perf_merge(&kernel_counts,    &workers[i].kernel);
+      perf_merge(&reference_counts, &workers[i].reference);
+      memset(&workers[i].kernel,    0, sizeof(struct perf_totals));
+      memset(&workers[i].reference, 0, sizeof(struct perf_totals));
     }
+    next = section_end;
 
-    if(es > 0) total_e += es;
-    else       total_e -= es;
-    
-    if(ec > 0) total_e += ec;
-    else       total_e -= ec;
+    if(next < end && hopeless(&totals, (end-next)*(sweep_fn == sweep_symmetric ? 4 : 1), why, sizeof(why))) {
+      stopped = 1;
+      break;
+    }
+    if(checkpoint && (next == end || seconds() - last_save >= interval)) {
+      save_checkpoint(t, checkpoint, symmetric, start, end, next, &totals);
+      last_save = seconds();
+    }
+  }
+  for(i = 0; i < threads; i++)
+    free(workers[i].stats.index);
+  free(workers);
 
-    if(max < es)  max =  es;
-    if(max < -es) max = -es;
-    if(max < ec)  max =  ec;
-    if(max < -ec) max = -ec;
-    count++;
+  if(stopped) {
+    /* A partial summary can't be merged, so just report what was found */
+    printf("Stopped early at phase %li, after %li of the %li phases to test: %s\n", next, next-start, end-start, why);
+    report(t, &totals);
+  } else if(summary) {
+    if(write_summary(t, summary, symmetric, shard, shards, start, end, &totals) != 0)
+      return 1;
+    printf("Shard %i of %i (phases %li to %li) written to '%s'\n", shard, shards, start, end-1, summary);
+  } else {
+    report(t, &totals);
   }
-  printf("Error is %13.11f per calcuation out of +/-%li\n",total_e/count, OUTPUT_SCALE);
-  printf("Max error is %13.11f, occured %li times\n",max, out_of_range);
-  return 0;
+  if(use_perf) {
+    printf("\n");
+    perf_print_header(stdout, "Counters");
+    perf_print(stdout, "setup()",   &setup_counts,     1.0);
+    perf_print(stdout, "kernel",    &kernel_counts,    1.0);
+    perf_print(stdout, "reference", &reference_counts, 1.0);
+    printf("Per phase tested:\n");
+    perf_print(stdout, "kernel",    &kernel_counts,    totals.count);
+    perf_print(stdout, "reference", &reference_counts, totals.count);
+  }
+  if(histograms && write_histograms(histograms, &totals) != 0)
+    return 1;
+  if(heatmap && write_heatmap(t, heatmap, &totals) != 0)
+    return 1;
+  free(totals.index);
+  free(totals.bad);
+  test_free(t);
+  return stopped ? 2 : 0;
 }
 /**************************************************************/
-
@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////
+// gen_tables.c : Writes the CORDIC tables for one configuration as C
+//
+// Author: Mike Field <hamster@snap.net.nz>
+//
+// Runs setup() for a configuration and writes initial[], angles[]
+// and shifts[] as constant arrays in a header. When cordic.c is built
+// with -DCORDIC_TABLES it includes that header as "cordic_tables.h",
+// and setup() uses the arrays rather than working out the tables,
+// so a program using that configuration starts without calling sin()
+// for every table entry. "make TABLES=1" does all this for the
+// configuration given in CONFIG.
+//
+// Released under the MIT license - see enhanced_cordic.c
+///////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "cordic.h"
+
+/* The same defaults as enhanced_cordic.c, which can be overridden in the same way */
+#ifndef INDEX_BITS
+#define INDEX_BITS        (11)
+#endif
+#ifndef CORDIC_BITS
+#define CORDIC_BITS       (19)
+#endif
+#ifndef CORDIC_REPS
+#define CORDIC_REPS       (24)
+#endif
+#ifndef OUTPUT_SCALE
+#define OUTPUT_SCALE      ((int64_t)1<<31)
+#endif
+#ifndef OUTPUT_EXTRA_BITS
+#define OUTPUT_EXTRA_BITS (4)
+#endif
+#ifndef Z_EXTRA_BITS
+#define Z_EXTRA_BITS      (2)
+#endif
+
+/* Write 'n' values, eight to a line */
+static void write_values(FILE *f, const char *type, const char *name, const void *values, int64_t n, int wide) {
+  int64_t i;
+
+  fprintf(f, "static const %s %s[%li] = {", type, name, n);
+  for(i = 0; i < n; i++) {
+    if(i % 8 == 0)
+      fprintf(f, "\n  ");
+    if(wide)
+      fprintf(f, "%li,%s", ((const int64_t *)values)[i], i % 8 == 7 ? "" : " ");
+    else
+      fprintf(f, "%i,%s", ((const int32_t *)values)[i], i % 8 == 7 ? "" : " ");
+  }
+  fprintf(f, "\n};\n\n");
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-I bits] [-C bits] [-R reps] [-O scale] [-E bits] [-Z bits] [-o file.h]\n", name);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  struct cordic_config cfg = {0};
+  const char *output = NULL;
+  FILE *f = stdout;
+  int opt;
+
+  cfg.index_bits        = INDEX_BITS;
+  cfg.cordic_bits       = CORDIC_BITS;
+  cfg.cordic_reps       = CORDIC_REPS;
+  cfg.output_scale      = OUTPUT_SCALE;
+  cfg.output_extra_bits = OUTPUT_EXTRA_BITS;
+  cfg.z_extra_bits      = Z_EXTRA_BITS;
+
+  while((opt = getopt(argc, argv, "I:C:R:O:E:Z:o:")) != -1) {
+    switch(opt) {
+      case 'I': cfg.index_bits        = atoi(optarg);           break;
+      case 'C': cfg.cordic_bits       = atoi(optarg);           break;
+      case 'R': cfg.cordic_reps       = atoi(optarg);           break;
+      case 'O': cfg.output_scale      = strtoll(optarg, NULL, 0); break;
+      case 'E': cfg.output_extra_bits = atoi(optarg);           break;
+      case 'Z': cfg.z_extra_bits      = atoi(optarg);           break;
+      case 'o': output                = optarg;                 break;
+      default:  usage(argv[0]);
+    }
+  }
+  if(optind != argc)
+    usage(argv[0]);
+
+  if(setup(&cfg) != 0) {
+    fprintf(stderr, "Invalid CORDIC configuration\n");
+    return 1;
+  }
+  if(cfg.built_in) {
+    fprintf(stderr, "gen_tables must be built without CORDIC_TABLES\n");
+    return 1;
+  }
+
+  if(output) {
+    f = fopen(output, "w");
+    if(f == NULL) {
+      fprintf(stderr, "Unable to write '%s'\n", output);
+      return 1;
+    }
+  }
+
+  fprintf(f, "/* Generated by gen_tables - do not edit */\n");
+  fprintf(f, "#define CORDIC_TABLES_INDEX_BITS        (%i)\n",  cfg.index_bits);
+  fprintf(f, "#define CORDIC_TABLES_CORDIC_BITS       (%i)\n",  cfg.cordic_bits);
+  fprintf(f, "#define CORDIC_TABLES_CORDIC_REPS       (%i)\n",  cfg.cordic_reps);
+  fprintf(f, "#define CORDIC_TABLES_OUTPUT_SCALE      (%liLL)\n", cfg.output_scale);
+  fprintf(f, "#define CORDIC_TABLES_OUTPUT_EXTRA_BITS (%i)\n",  cfg.output_extra_bits);
+  fprintf(f, "#define CORDIC_TABLES_Z_EXTRA_BITS      (%i)\n",  cfg.z_extra_bits);
+  fprintf(f, "#define CORDIC_TABLES_NARROW            (%i)\n\n", cfg.narrow);
+
+  write_values(f, "int32_t", "cordic_table_angles",  cfg.angles,  cfg.cordic_reps, 0);
+  write_values(f, "int32_t", "cordic_table_shifts",  cfg.shifts,  cfg.cordic_reps, 0);
+  write_values(f, "int64_t", "cordic_table_initial", cfg.initial, cfg.table_size,  1);
+  if(cfg.narrow)
+    write_values(f, "int32_t", "cordic_table_initial32", cfg.initial32, cfg.table_size, 0);
+
+  cordic_free(&cfg);
+  if(output && fclose(f) != 0) {
+    fprintf(stderr, "Unable to write '%s'\n", output);
+    return 1;
+  }
+  return 0;
+}
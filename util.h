@@ -0,0 +1,32 @@
+///////////////////////////////////////////////////////////////////////////
+// util.h : Small helpers shared by the CORDIC code and test programs
+//
+// Author: Mike Field <hamster@snap.net.nz>
+//
+// Released under the MIT license - see enhanced_cordic.c
+///////////////////////////////////////////////////////////////////////////
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define PI                (3.14159265358979323846)
+
+/* Monotonic wall clock time, in seconds */
+static inline double seconds(void) {
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* splitmix64, so each stream is fixed by its seed alone */
+static inline uint64_t next_random(uint64_t *state) {
+   uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+   return z ^ (z >> 31);
+}
+
+#endif